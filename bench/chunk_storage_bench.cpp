@@ -0,0 +1,98 @@
+// Compares the memory use and lookup latency of the palette-compressed chunk
+// storage against the original std::map of Blocks and a plain byte array.
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "block.hpp"
+#include "chunk.hpp"
+
+const int CHUNKS = 8;  // Along each side of the benchmarked area
+const int QUERIES = 1 << 24;
+const size_t VOLUME = Chunk::SIZE * Chunk::SIZE * Chunk::DEPTH;
+
+// Size of the red-black tree node header in libstdc++ (color, parent, left, right)
+const size_t MAP_NODE_OVERHEAD = 4 * sizeof(void*);
+
+typedef std::map<Coordinate, std::unique_ptr<Block>> BlockMap;
+
+static size_t flatIndex(const Coordinate& r) {
+    int i = r.x & (Chunk::SIZE - 1), j = r.z & (Chunk::SIZE - 1);
+    return (i * Chunk::SIZE + j) * Chunk::DEPTH + r.y;
+}
+
+template <typename F>
+static void timeQueries(const char* name, size_t bytes, const std::vector<Coordinate>& queries,
+                        F lookup) {
+    auto start = std::chrono::steady_clock::now();
+
+    size_t found = 0;
+    for (const Coordinate& query : queries) found += lookup(query);
+
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count() / queries.size();
+
+    std::cout << name << ": " << bytes / (CHUNKS * CHUNKS) << " bytes/chunk, " << ns
+              << " ns/get (" << found << " hits)" << std::endl;
+}
+
+int main() {
+    std::vector<std::unique_ptr<Chunk>> chunks;
+    std::vector<BlockMap> maps(CHUNKS * CHUNKS);
+    std::vector<std::vector<uint8_t>> arrays(CHUNKS * CHUNKS);
+
+    size_t paletteBytes = 0, mapBytes = 0, arrayBytes = 0;
+    for (int x = 0; x < CHUNKS; ++x) {
+        for (int z = 0; z < CHUNKS; ++z) {
+            chunks.emplace_back(new Chunk(x, z, 0));
+            const Chunk& chunk = *chunks.back();
+            paletteBytes += chunk.memoryUsage();
+
+            BlockMap& blocks = maps[x * CHUNKS + z];
+            std::vector<uint8_t>& array = arrays[x * CHUNKS + z];
+            array.assign(VOLUME, 0);
+
+            chunk.forEachBlock([&](const Block& block) {
+                blocks[block.location].reset(new Block(block));
+                array[flatIndex(block.location)] = block.blockType + 1;
+            });
+
+            mapBytes += blocks.size() *
+                        (MAP_NODE_OVERHEAD + sizeof(BlockMap::value_type) + sizeof(Block));
+            arrayBytes += array.size();
+        }
+    }
+
+    std::mt19937 rng(0);
+    std::uniform_int_distribution<int> horizontal(0, CHUNKS * Chunk::SIZE - 1);
+    std::uniform_int_distribution<int> vertical(0, Chunk::DEPTH - 1);
+
+    std::vector<Coordinate> queries;
+    for (int i = 0; i < QUERIES; ++i) {
+        queries.emplace_back(horizontal(rng), vertical(rng), horizontal(rng));
+    }
+
+    auto chunkIndex = [](const Coordinate& r) {
+        return (r.x / Chunk::SIZE) * CHUNKS + r.z / Chunk::SIZE;
+    };
+
+    timeQueries("std::map", mapBytes, queries, [&](const Coordinate& r) {
+        const BlockMap& blocks = maps[chunkIndex(r)];
+        return blocks.find(r) != blocks.end();
+    });
+
+    timeQueries("byte array", arrayBytes, queries, [&](const Coordinate& r) {
+        return arrays[chunkIndex(r)][flatIndex(r)] != 0;
+    });
+
+    timeQueries("palette", paletteBytes, queries, [&](const Coordinate& r) {
+        return bool(chunks[chunkIndex(r)]->get(r));
+    });
+
+    return 0;
+}
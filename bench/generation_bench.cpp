@@ -0,0 +1,60 @@
+// Measures how many chunks per second the terrain generator produces, on a
+// single thread and with one thread per hardware thread.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "chunk.hpp"
+
+const int CHUNKS = 16;  // Along each side of the generated area
+const unsigned int SEED = 0;
+
+// Every thread takes the next chunk of the area until there are none left
+static double chunksPerSecond(unsigned int threadCount) {
+    std::atomic<int> next(0);
+    std::atomic<size_t> blocks(0);
+
+    auto work = [&] {
+        size_t found = 0;
+        for (int n = next++; n < CHUNKS * CHUNKS; n = next++) {
+            Chunk chunk(n / CHUNKS, n % CHUNKS, SEED);
+            chunk.forEachBlock([&found](const Block&) { ++found; });
+        }
+
+        blocks += found;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < threadCount; ++i) threads.emplace_back(work);
+    for (std::thread& thread : threads) thread.join();
+
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+
+    // Counting the blocks keeps the generation from being optimized away
+    if (blocks == 0) std::cout << "no blocks generated" << std::endl;
+
+    return CHUNKS * CHUNKS / seconds;
+}
+
+int main() {
+    // The noise generators are built on first use, which shouldn't be timed
+    Chunk warmUp(0, 0, SEED);
+
+    unsigned int threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+    double single = chunksPerSecond(1);
+    std::cout << "1 thread: " << single << " chunks/s" << std::endl;
+
+    double parallel = chunksPerSecond(threadCount);
+    std::cout << threadCount << " threads: " << parallel << " chunks/s (" << parallel / single
+              << "x)" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,87 @@
+// Compares chunks generated with the noise fields sampled on coarse lattices
+// against chunks with every cell sampled exactly, for both speed and how much
+// the terrain changes.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "chunk.hpp"
+
+const int CHUNKS = 8;  // Along each side of the benchmarked area
+const unsigned int SEED = 0;
+
+typedef std::vector<std::unique_ptr<Chunk>> Chunks;
+
+static Chunks generate(const Chunk::NoiseLattice& lattice, double& msPerChunk) {
+    Chunk::TerrainConfig terrain;
+    terrain.lattice = lattice;
+
+    auto start = std::chrono::steady_clock::now();
+
+    Chunks chunks;
+    for (int x = 0; x < CHUNKS; ++x) {
+        for (int z = 0; z < CHUNKS; ++z) chunks.emplace_back(new Chunk(x, z, SEED, terrain));
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    msPerChunk = std::chrono::duration<double, std::milli>(end - start).count() / chunks.size();
+
+    return chunks;
+}
+
+// The error is measured in what the player could actually see: blocks which
+// came out differently, and columns whose surface moved
+static void compare(const Chunks& exact, const Chunks& approximate) {
+    size_t cells = 0, changedCells = 0, columns = 0, movedColumns = 0;
+    int maxMove = 0;
+
+    for (size_t n = 0; n < exact.size(); ++n) {
+        const Chunk& a = *exact[n];
+        const Chunk& b = *approximate[n];
+
+        for (int i = 0; i < Chunk::SIZE; ++i) {
+            for (int j = 0; j < Chunk::SIZE; ++j) {
+                int x = a.x() * Chunk::SIZE + i, z = a.z() * Chunk::SIZE + j;
+                for (int k = 0; k < Chunk::DEPTH; ++k) {
+                    Coordinate r(x, k, z);
+                    changedCells += a.get(r) != b.get(r);
+                    ++cells;
+                }
+
+                int move = std::abs(a.height(x, z) - b.height(x, z));
+                movedColumns += move != 0;
+                maxMove = std::max(maxMove, move);
+                ++columns;
+            }
+        }
+    }
+
+    std::cout << 100.0 * changedCells / cells << "% of blocks changed, "
+              << 100.0 * movedColumns / columns << "% of surfaces moved (by at most " << maxMove
+              << ")";
+}
+
+int main() {
+    double exactMs;
+    Chunks exact = generate(Chunk::NoiseLattice(), exactMs);
+    std::cout << "exact: " << exactMs << " ms/chunk" << std::endl;
+
+    const Chunk::NoiseLattice lattices[] = {{2, 2, 2}, {2, 4, 2}, {4, 4, 4}, {4, 8, 4}, {8, 8, 8}};
+    for (const Chunk::NoiseLattice& lattice : lattices) {
+        double ms;
+        Chunks approximate = generate(lattice, ms);
+
+        int samples = (Chunk::SIZE / lattice.x + 1) * (Chunk::DEPTH / lattice.y + 1) *
+                      (Chunk::SIZE / lattice.z + 1);
+        std::cout << lattice.x << "x" << lattice.y << "x" << lattice.z << ": " << ms
+                  << " ms/chunk, " << samples << " samples per field, ";
+        compare(exact, approximate);
+        std::cout << std::endl;
+    }
+
+    return 0;
+}
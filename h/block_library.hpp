@@ -20,10 +20,13 @@ public:
     static const Tag DIRT = 2;
     static const Tag STONE = 3;
 
+    // The number of block types, so every tag is less than this
+    static const size_t TYPES = 4;
+
     BlockLibrary();
 
     GLuint getTextureArray() const { return m_textureArray; }
-    size_t size() const { return 4; }
+    size_t size() const { return TYPES; }
 
     size_t textureResolution() const { return m_resolution; }
     size_t texturePixels() const { return m_resolution * m_resolution; }
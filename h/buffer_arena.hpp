@@ -0,0 +1,95 @@
+#ifndef BUFFER_ARENA_HPP
+#define BUFFER_ARENA_HPP
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <map>
+
+// Sub-allocates ranges of fixed-size elements out of a few large GPU buffers,
+// so that meshes don't each need a buffer of their own. Each buffer keeps a
+// free list of the ranges between allocations, ordered by offset, and
+// allocation takes the first free range which is big enough. A new buffer is
+// created whenever none of them has room.
+class BufferArena {
+public:
+    // Every buffer holds at least pageElements elements of elementSize bytes
+    BufferArena(size_t elementSize, size_t pageElements);
+    ~BufferArena();
+
+    BufferArena(const BufferArena& other) = delete;
+    BufferArena& operator=(const BufferArena& other) = delete;
+
+    // A range of elements within one of the buffers. A null allocation has a
+    // buffer of 0.
+    struct Allocation {
+        GLuint buffer = 0;
+        size_t first = 0, count = 0;
+    };
+
+    // Space for at least count elements. Sizes are rounded up, so that a mesh
+    // which grows a little can often stay where it is.
+    Allocation allocate(size_t count);
+    void free(const Allocation& allocation);
+
+    // Makes allocation big enough for count elements, without keeping its
+    // contents. It stays in place if the new size fits without wasting more than
+    // half of it, and otherwise is moved within its own buffer if it can be.
+    void reallocate(Allocation& allocation, size_t count);
+
+    // Copies count elements into the start of an allocation
+    void upload(const Allocation& allocation, const void* data, size_t count);
+
+    // Freeing allocations can leave buffers mostly empty but still holding a few
+    // allocations. Such a buffer is defragmented by relocating each of its
+    // allocations into the other buffers, which copies the contents on the GPU,
+    // and the buffer is deleted once it is empty. fragmentedBuffer() returns 0
+    // if no buffer needs to be emptied, and relocate() returns false and leaves
+    // the allocation alone if no other buffer has room for it.
+    GLuint fragmentedBuffer() const;
+    bool relocate(Allocation& allocation);
+
+    // Changes whenever anything is allocated or freed. fragmentedBuffer() only
+    // compares the total free space, which may be split into ranges too small to
+    // take an allocation, so once relocate() has failed it will keep failing
+    // until the generation changes.
+    size_t generation() const { return m_generation; }
+
+    struct Stats {
+        size_t buffers, allocations;
+
+        // In bytes
+        size_t capacity, used;
+    };
+
+    Stats stats() const;
+
+private:
+    // Allocation sizes are rounded up to a multiple of this many elements
+    static const size_t GRANULARITY = 64;
+
+    struct Page {
+        size_t capacity, used;
+
+        // Map from the first element of each free range to its size
+        std::map<size_t, size_t> freeRanges;
+    };
+
+    static size_t roundUp(size_t count);
+
+    // Only uses the existing buffers, other than the excluded one
+    bool allocateExisting(size_t count, GLuint exclude, Allocation& allocation);
+    bool allocateFrom(GLuint buffer, Page& page, size_t count, Allocation& allocation);
+
+    // Gives a range back to the free list of its buffer. Unlike free(), this
+    // never deletes the buffer, which dropIfEmpty() does if nothing is left in it.
+    void release(const Allocation& allocation);
+    void dropIfEmpty(GLuint buffer);
+
+    size_t m_elementSize, m_pageElements;
+    size_t m_allocations;
+    size_t m_generation;
+    std::map<GLuint, Page> m_pages;
+};
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef BYTE_STREAM_HPP
+#define BYTE_STREAM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+// Helpers for the binary formats used to save the world. Integers are always
+// stored little-endian, whatever the byte order of the machine.
+template <typename T>
+void putInteger(std::vector<uint8_t>& out, T value) {
+    static_assert(std::is_integral<T>::value, "Only integers can be written");
+
+    typedef typename std::make_unsigned<T>::type Unsigned;
+    for (size_t i = 0; i < sizeof(T); ++i) out.push_back(uint8_t(Unsigned(value) >> (8 * i)));
+}
+
+// Pads with zeros up to a multiple of alignment bytes from the start of out
+inline void putPadding(std::vector<uint8_t>& out, size_t alignment) {
+    out.resize(out.size() + (alignment - out.size() % alignment) % alignment, 0);
+}
+
+// Reads back what was written with putInteger. Reading past the end of the
+// data gives zeros and marks the reader as failed, so that a whole record can
+// be read before checking for errors once.
+class ByteReader {
+public:
+    ByteReader(const uint8_t* data, size_t size)
+    : m_start(data), m_data(data), m_end(data + size), m_failed(false) {}
+
+    template <typename T>
+    T getInteger() {
+        static_assert(std::is_integral<T>::value, "Only integers can be read");
+
+        const uint8_t* bytes = getBytes(sizeof(T));
+        if (!bytes) return 0;
+
+        typedef typename std::make_unsigned<T>::type Unsigned;
+        Unsigned value = 0;
+        for (size_t i = 0; i < sizeof(T); ++i) value |= Unsigned(bytes[i]) << (8 * i);
+
+        return T(value);
+    }
+
+    // Returns null if there are fewer than count bytes left
+    const uint8_t* getBytes(size_t count) {
+        if (m_failed || size_t(m_end - m_data) < count) {
+            m_failed = true;
+            return nullptr;
+        }
+
+        const uint8_t* result = m_data;
+        m_data += count;
+        return result;
+    }
+
+    // Skips padding up to a multiple of alignment bytes from the start
+    void align(size_t alignment) {
+        size_t offset = m_data - m_start;
+        getBytes((alignment - offset % alignment) % alignment);
+    }
+
+    bool failed() const { return m_failed; }
+    bool atEnd() const { return m_data == m_end; }
+
+private:
+    const uint8_t* m_start;
+    const uint8_t* m_data;
+    const uint8_t* m_end;
+    bool m_failed;
+};
+
+#endif
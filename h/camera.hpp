@@ -4,13 +4,16 @@
 #include <glm/glm.hpp>
 
 struct Camera {
-    Camera() : horizontalAngle(0), verticalAngle(0) {}
+    Camera() : velocity(0.0f), horizontalAngle(0), verticalAngle(0) {}
 
     glm::vec3 gaze() const;
 
     // Camera location in world coordinates
     glm::vec3 eye;
 
+    // Velocity of the eye over the last update, in blocks / s
+    glm::vec3 velocity;
+
     // Camera rotation about the y-axis
     float horizontalAngle;
 
@@ -1,13 +1,16 @@
 #ifndef CHUNK_HPP
 #define CHUNK_HPP
 
+#include <array>
 #include <cstdint>
-#include <map>
 #include <memory>
-#include <set>
+#include <optional>
+#include <stdexcept>
+#include <vector>
 
 #include "block.hpp"
 #include "block_library.hpp"
+#include "chunk_section.hpp"
 #include "coordinate.hpp"
 #include "mesh.hpp"
 
@@ -17,29 +20,207 @@ public:
     static const int SIZE = 1 << 4;   // Range of x and z dimensions
     static const int DEPTH = 1 << 6;  // Range of y dimension
 
+    // The chunk is split vertically into sections, numbered from the bottom
+    static const int SECTION_HEIGHT = ChunkSection::HEIGHT;
+    static const int SECTIONS = DEPTH / SECTION_HEIGHT;
+
+    // The 3D noise fields of the terrain can be sampled on a lattice coarser
+    // than the cells, every x, y and z cells, with the cells in between
+    // interpolated. The fields are smooth enough that this barely changes the
+    // terrain, for a small fraction of the noise evaluations. Each spacing must
+    // divide the chunk in its dimension, or std::invalid_argument is thrown. By
+    // default, every cell is sampled.
+    struct NoiseLattice {
+        NoiseLattice() : x(1), y(1), z(1) {}
+        NoiseLattice(int x, int y, int z) : x(x), y(y), z(z) {
+            if (!valid()) throw std::invalid_argument("Noise lattice must divide the chunk");
+        }
+
+        bool valid() const {
+            return x > 0 && y > 0 && z > 0 && SIZE % x == 0 && DEPTH % y == 0 && SIZE % z == 0;
+        }
+
+        int x, y, z;
+    };
+
+    // Everything about the shape of the terrain that isn't fixed at compile
+    // time. The number of octaves of each noise field is part of its type in
+    // chunk.cpp, so that summing them costs nothing per sample. Frequencies are
+    // in cycles per block.
+    struct TerrainConfig {
+        TerrainConfig()
+        : hillFrequency(1 / 128.0), hillHeight(12.0), detailFrequency(1 / 16.0), carving(2.0),
+          caves(3.0), falloff(8.0), stone(0.5), seaLevel(0.45 * DEPTH), caveThreshold(-0.1) {}
+
+        // The surface rises and falls around the middle of the chunk by up to
+        // hillHeight blocks, over distances of about 1 / hillFrequency
+        float hillFrequency;
+        float hillHeight;
+
+        // The density field is sampled at detailFrequency, and at carving times
+        // that vertically, so larger carving means more overhangs and caves.
+        // Larger caves is the same for the cave field.
+        float detailFrequency;
+        float carving;
+        float caves;
+
+        // The number of blocks below the surface over which the ground goes
+        // from empty to solid. Larger means noisier, more broken terrain.
+        float falloff;
+
+        // Solid ground with a density above stone is stone rather than dirt.
+        // Empty cells below seaLevel are filled with water.
+        float stone;
+        float seaLevel;
+
+        // Cells are carved out where the cube of the cave field is at most this
+        float caveThreshold;
+
+        NoiseLattice lattice;
+    };
+
     // Both x and z are in units of chunks
-    Chunk(int x = 0, int z = 0, unsigned int seed = 0);
+    Chunk(int x = 0, int z = 0, unsigned int seed = 0,
+          const TerrainConfig& terrain = TerrainConfig());
+
+    // Identifies the terrain generated from a config. It changes with any field
+    // of the config, and whenever the generator itself changes, so edits made
+    // to generated chunks can only be replayed onto chunks with the same id.
+    static uint64_t generatorId(const TerrainConfig& terrain);
 
     int x() const { return m_x; }
     int z() const { return m_z; }
-    const std::map<Coordinate, std::unique_ptr<Block>>& blocks() const { return m_blocks; }
+
+    // Call f(const Block&) for every non-empty block in the chunk, or in one
+    // section of it. Blocks are visited in storage order, so this walks memory
+    // linearly.
+    template <typename F>
+    void forEachBlock(F f) const;
+    template <typename F>
+    void forEachBlock(int section, F f) const;
+
+    // Sections containing nothing at all, or containing only opaque blocks.
+    // These let whole sections be skipped when meshing or searching.
+    bool isSectionEmpty(int section) const { return m_sectionFlags[section] & EMPTY_SECTION; }
+    bool isSectionOpaque(int section) const { return m_sectionFlags[section] & OPAQUE_SECTION; }
+
+    // Bit j of connectedFaces(section, i) is set if face i of the section is
+    // joined to face j by a path through its non-opaque cells, with the faces
+    // in the order +x, -x, +y, -y, +z, -z. Nothing can be seen through a
+    // section from one face to another unless they are connected.
+    unsigned int connectedFaces(int section, int face) const {
+        return m_connectivity[section][face];
+    }
 
     // Access the world
     bool isTransparent(const Coordinate& location) const;
     bool isSolid(const Coordinate& location) const;
     bool openToSky(const Coordinate& location) const;
 
-    // This pointer will be invalidated if the block is removed
-    const Block* get(const Coordinate& location) const;
+    // The y coordinate of the highest non-transparent block in a column, or -1
+    // if the column is entirely transparent
+    int height(int x, int z) const;
+
+    // Returns nothing if there is no block at this location (including any
+    // location above or below the chunk)
+    std::optional<BlockLibrary::Tag> get(const Coordinate& location) const;
+
+    // Occupancy of a whole column, with bit k describing the block at height k.
+    // Filled blocks are all non-empty blocks, and opaque blocks are the filled
+    // blocks which aren't transparent. Columns outside of the chunk are empty.
+    struct Column {
+        uint64_t filled, opaque;
+    };
+    static_assert(DEPTH == 64, "A column must fit in a 64-bit word");
+    Column column(int x, int z) const;
 
+    // Locations outside of the range [0, DEPTH) in y are ignored
     void newBlock(int x, int y, int z, BlockLibrary::Tag tag);
     void removeBlock(const Coordinate& location);
 
+    // Total memory used by this chunk, in bytes
+    size_t memoryUsage() const;
+
+    // Chunks are saved in a compact binary format, with each section stored as
+    // it is in memory. read() returns nothing if the data is malformed. If the
+    // data belongs to a mapped file, the sections may use it in place, keeping
+    // the mapping alive. See ChunkSection::read().
+    void write(std::vector<uint8_t>& out) const;
+    static std::optional<Chunk> read(const uint8_t* data, size_t size,
+                                     std::shared_ptr<const void> mapping = nullptr);
+
 private:
-    static const int SCALE = 1 << 5;  // Scale of top-level terrain features
+    // Bumped whenever the saved format changes. Only the current version can be
+    // read.
+    static const uint8_t FORMAT_VERSION = 2;
+
+    // Bumped whenever the same seed and config would generate different terrain
+    static const uint32_t GENERATOR_VERSION = 1;
+
+    // A chunk of nothing but air, to be filled in by read()
+    struct Empty {};
+    Chunk(int x, int z, Empty);
+
+    typedef ChunkSection::BlockId BlockId;
+    static constexpr BlockId EMPTY = ChunkSection::EMPTY;
+
+    static_assert(ChunkSection::SIZE == SIZE, "Sections must span the whole chunk");
+    static_assert(DEPTH % ChunkSection::HEIGHT == 0, "Sections must tile the chunk");
+
+    // Finds the section and the index within it of a world location, or
+    // returns false if it lies outside of the chunk
+    bool locate(const Coordinate& location, int& section, size_t& index) const;
+
+    // Must be called whenever the contents of a section change
+    static const uint8_t EMPTY_SECTION = 1 << 0;
+    static const uint8_t OPAQUE_SECTION = 1 << 1;
+    void updateSectionFlags(int section);
+
+    // Must be called whenever the contents of a section change, after its flags
+    // are updated
+    void updateConnectivity(int section);
+
+    // Must be called whenever the block at a location changes. Sets or clears
+    // the location's bit in its column's mask, so it is constant time.
+    void updateHeight(const Coordinate& location);
 
     int m_x, m_z;
-    std::map<Coordinate, std::unique_ptr<Block>> m_blocks;
+    std::array<ChunkSection, SECTIONS> m_sections;
+    std::array<uint8_t, SECTIONS> m_sectionFlags;
+    std::array<std::array<uint8_t, 6>, SECTIONS> m_connectivity;
+
+    // The non-transparent blocks of each column, with bit k set when the block
+    // at height k is opaque, so the height is the highest set bit. Indexed by
+    // (x, z) relative to the chunk. See height().
+    std::array<uint64_t, SIZE * SIZE> m_opaqueColumns;
+
+    // Heights are saved as an int8_t per column
+    static_assert(DEPTH <= 128, "Heights must fit in an int8_t");
 };
 
-#endif
\ No newline at end of file
+template <typename F>
+void Chunk::forEachBlock(F f) const {
+    for (int s = 0; s < SECTIONS; ++s) forEachBlock(s, f);
+}
+
+template <typename F>
+void Chunk::forEachBlock(int s, F f) const {
+    if (isSectionEmpty(s)) return;
+
+    const ChunkSection& section = m_sections[s];
+
+    size_t index = 0;
+    for (int i = 0; i < SIZE; ++i) {
+        for (int j = 0; j < SIZE; ++j) {
+            for (int k = 0; k < SECTION_HEIGHT; ++k, ++index) {
+                BlockId id = section.get(index);
+                if (id == EMPTY) continue;
+
+                Coordinate location(m_x * SIZE + i, s * SECTION_HEIGHT + k, m_z * SIZE + j);
+                f(Block(location, id - 1));
+            }
+        }
+    }
+}
+
+#endif
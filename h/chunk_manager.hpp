@@ -3,38 +3,94 @@
 
 #include <GL/glew.h>
 
-#include <map>
+#include <array>
+#include <cstdint>
+#include <deque>
 #include <memory>
+#include <optional>
 #include <set>
+#include <string>
 #include <vector>
 
 #include "block.hpp"
 #include "camera.hpp"
 #include "chunk.hpp"
+#include "chunk_mesher.hpp"
+#include "chunk_queue.hpp"
+#include "chunk_store.hpp"
+#include "completion_queue.hpp"
 #include "coordinate.hpp"
+#include "edit_log.hpp"
+#include "frustum.hpp"
+#include "job_system.hpp"
 #include "mesh.hpp"
 
 class ChunkManager {
 public:
     static const int RENDER_RADIUS = 4;
 
-    ChunkManager(int seed);
+    // Chunks stay resident (without a mesh) out to this distance, so that
+    // returning to an area doesn't generate it again
+    static const int CACHE_RADIUS = 8 * RENDER_RADIUS;
 
-    std::vector<const Mesh*> getVisibleMeshes(const Camera& camera);
+    // Width of the grid of resident chunks. This must be a power of two.
+    static const int GRID_SIZE = 2 * CACHE_RADIUS;
+    static_assert((GRID_SIZE & (GRID_SIZE - 1)) == 0, "GRID_SIZE must be a power of two");
+
+    // Chunks are saved in the given directory, and the seed of a world which
+    // was saved there before takes the place of the given one. Nothing is saved
+    // if the directory is empty. The terrain config is used to generate every
+    // chunk. Edit logs are replayed onto freshly generated chunks, so if the
+    // saved world was generated with a different config or generator, its edit
+    // logs are ignored and chunks are saved whole instead. Throws
+    // std::invalid_argument if the config's noise lattice isn't valid.
+    ChunkManager(int seed, const std::string& directory = std::string(),
+                 ChunkStore::Format format = ChunkStore::COMPRESSED,
+                 const Chunk::TerrainConfig& terrain = Chunk::TerrainConfig());
+
+    // Saves every chunk which hasn't been saved since it last changed
+    ~ChunkManager();
+
+    // Meshes of the sections around the camera which intersect the view
+    // frustum and aren't hidden behind solid ground, from front to back
+    std::vector<const Mesh*> getVisibleMeshes(const Camera& camera, const Frustum& frustum);
 
     // Access the world
-    const Block* getBlock(const Coordinate& location) const;
+    std::optional<BlockLibrary::Tag> getBlock(const Coordinate& location) const;
     bool isTransparent(const Coordinate& location) const;
     bool isSolid(const Coordinate& location) const;
     bool isEmpty(const Coordinate& location) const;
 
+    // Generates any chunks overlapping the box which aren't resident yet, right
+    // away on this thread. Everything else is loaded in the background, so this
+    // is only for the blocks that the player is about to collide with.
+    void loadNow(const glm::vec3& min, const glm::vec3& max);
+
     // Modify the world
     void removeBlock(const Coordinate& location);
     void createBlock(const Coordinate& location, BlockLibrary::Tag tag);
 
+    // Memory used by the vertex buffers of the meshes
+    BufferArena::Stats meshMemory() const { return m_meshArena.stats(); }
+
+    // Greedy meshing merges adjacent faces of the same type into larger quads.
+    // Changing the mode rebuilds every mesh.
+    bool greedyMeshing() const { return m_greedyMeshing; }
+    void setGreedyMeshing(bool greedy);
+
+    // Occlusion culling skips sections which can't be seen from the camera's
+    // section through the open cells of the sections in between
+    bool occlusionCulling() const { return m_occlusionCulling; }
+    void setOcclusionCulling(bool enabled) { m_occlusionCulling = enabled; }
+
 private:
     // The seed for the PRNG used by the terrain generator
     int m_seed;
+    Chunk::TerrainConfig m_terrain;
+
+    // False if the saved world was generated differently, so that its edit logs
+    // no longer apply
+    bool m_replayEdits;
 
     // Return null if the chunk is not resident or has not been generated
     const Chunk* getChunk(int x, int z) const;
@@ -42,33 +98,163 @@ private:
     const Chunk* getChunk(const Coordinate& location) const;
     Chunk* getChunk(const Coordinate& location);
 
-    // The first of these will return nullptr if the mesh has not been
-    // generated yet.
-    Mesh* getMesh(const Chunk* chunk) const;
-    Mesh* getOrCreateMesh(const Chunk* chunk);
+    // Each section of a chunk has its own mesh, so that an edit only has to
+    // rebuild the sections that it touches. A null mesh means that the section
+    // has no visible faces.
+    typedef std::array<std::unique_ptr<Mesh>, Chunk::SECTIONS> ChunkMeshes;
+
+    // Returns nullptr if the chunk has not been meshed yet
+    const ChunkMeshes* getMeshes(const Chunk* chunk) const;
+
+    // All of the meshes share a few large vertex buffers. Each buffer holds 8MB
+    // of vertices, which is enough for several hundred typical sections.
+    static const size_t MESH_BUFFER_VERTICES = 1 << 20;
+    BufferArena m_meshArena;
+
+    // Empties the most fragmented vertex buffer, if any, a few meshes at a time
+    // until the per-frame time budget runs out. The grid is scanned from where
+    // the last frame stopped. If a mesh can't be moved, nothing more is tried
+    // until the arena's generation changes.
+    void defragmentMeshes();
+    size_t m_defragmentSlot;
+    std::optional<size_t> m_defragmentFailed;
+
+    // Resident chunks are kept in a fixed-size toroidal grid which slides along
+    // with the camera. Chunk (x, z) can only live in slot (x mod GRID_SIZE,
+    // z mod GRID_SIZE), so finding a chunk is a single index, and loading a
+    // chunk just replaces whatever was in its slot.
+    struct Slot {
+        std::optional<Chunk> chunk;
+
+        // Set once meshes have been requested, even if they haven't arrived yet
+        bool meshed = false;
+        ChunkMeshes meshes;
+        std::array<uint64_t, Chunk::SECTIONS> meshVersions;
+
+        // Mask of meshed sections which have been edited since they were meshed
+        uint8_t dirtySections = 0;
+
+        // Set if the chunk was generated or edited since it was last saved
+        bool unsaved = false;
+
+        // When only edits are being saved, every edit made to a generated chunk
+        // is recorded here. Chunks loaded whole have no log, and are saved whole.
+        std::optional<EditLog> edits;
+    };
+
+    std::vector<Slot> m_grid;
+    Slot& slot(int x, int z) {
+        return m_grid[(x & (GRID_SIZE - 1)) * GRID_SIZE + (z & (GRID_SIZE - 1))];
+    }
+    const Slot& slot(int x, int z) const {
+        return m_grid[(x & (GRID_SIZE - 1)) * GRID_SIZE + (z & (GRID_SIZE - 1))];
+    }
 
-    static const size_t MAX_OBJECTS = 10 * RENDER_RADIUS * RENDER_RADIUS;
-    std::vector<GLuint> m_vboPool;
-    void freeMesh(const Chunk* chunk);
+    void freeMeshes(Slot& slot);
+
+    // Puts a chunk into its slot, replacing whatever chunk was there before,
+    // unless it is already resident
+    void placeChunk(Chunk&& chunk, bool unsaved, std::optional<EditLog> edits = std::nullopt);
+
+    // Places a chunk which was just generated, with any saved edits applied
+    void placeGeneratedChunk(Chunk&& chunk, std::optional<EditLog> edits);
+
+    // Empties a slot, saving its chunk first if necessary
+    void evictChunk(Slot& slot);
+
+    // Chunk work is split into three queues, each ordered by distance from the
+    // camera and each with its own time budget per frame. These are chunks which
+    // should be meshed, which first requires them and their neighbors to be
+    // loaded, meshed chunks with edited sections, and chunks which may have
+    // moved out of range. Each queue is only worked through until its budget
+    // runs out, and the rest waits for the next frame.
+    ChunkQueue m_chunkQueue;
+    ChunkQueue m_remeshQueue;
+    ChunkQueue m_unloadQueue;
+
+    void processChunkQueue();
+    void processRemeshQueue();
+    void processUnloadQueue();
+
+    // Chunks are loaded from the store if they have been saved before, and are
+    // otherwise generated on the job system's worker threads and handed back
+    // through m_finishedChunks. A chunk whose edit log was saved is generated,
+    // and then the edits are replayed on the worker. Only a couple of chunks per
+    // worker are in flight at any time, so that the closest chunks to the camera
+    // are generated first.
+    // The job system is declared last so that its workers are stopped before
+    // anything they use is destroyed.
+    size_t maxPending() const { return 2 * m_jobSystem.threadCount(); }
+    std::set<std::pair<int, int>> m_pendingChunks;
+    struct GeneratedChunk {
+        Chunk chunk;
+        std::optional<EditLog> edits;
+    };
+    CompletionQueue<GeneratedChunk> m_finishedChunks;
+    std::unique_ptr<ChunkStore> m_store;
 
-    std::set<std::pair<int, int>> m_chunkQueue;
     void loadOrCreateChunk(int x, int z);
-    std::map<std::pair<int, int>, std::unique_ptr<Chunk>> m_chunks;
-
-    // Determine which of the faces (if any) of a given block are not adjacent
-    // to an opaque block
-    static const unsigned int PLUS_X = 1 << 0;
-    static const unsigned int MINUS_X = 1 << 1;
-    static const unsigned int PLUS_Y = 1 << 2;
-    static const unsigned int MINUS_Y = 1 << 3;
-    static const unsigned int PLUS_Z = 1 << 4;
-    static const unsigned int MINUS_Z = 1 << 5;
-    unsigned int getLiveFaces(const Coordinate& r) const;
-
-    // Determine all triangles which could possibly be visible
-    void rebuildMesh(const Chunk* chunk, Mesh* mesh);
-
-    std::map<const Chunk*, std::unique_ptr<Mesh>> m_meshes;
+    void generateChunk(int x, int z, std::optional<EditLog> edits = std::nullopt);
+    void collectFinishedChunks();
+
+    // When the camera moves into a different chunk, the queues are centered on
+    // the new chunk, and all of the resident chunks which are far enough away to
+    // lose their meshes or be unloaded are queued for unloading
+    std::pair<int, int> m_cameraChunk;
+    void moveCamera(const Camera& camera);
+
+    // Chunks are also loaded and meshed ahead of the camera, within the render
+    // radius of where it will be after PREFETCH_TIME seconds at its current
+    // velocity. The chunk queue is centered a little ahead of that position in
+    // the direction of the gaze, so that the chunks in view come first.
+    static constexpr float PREFETCH_TIME = 2.0;
+    std::pair<int, int> m_predictedChunk;
+    void prefetch(const Camera& camera);
+
+    // Within the render radius of either the camera or its predicted position
+    bool inRange(int x, int z) const;
+
+    // True if the chunk is more than radius chunks from the camera's chunk
+    bool isDistant(int x, int z, int radius) const;
+
+    // Flood fills outward from the camera's section through the sections within
+    // the render radius, stepping from one section to the next only if it lies
+    // in the frustum and the step leaves through a face connected to the one it
+    // came in through. The search never turns back in a direction opposite to
+    // one it has already moved in. Returns the mask of reached sections of each
+    // chunk, indexed by visibleIndex(). Without occlusion culling, every
+    // section in the frustum is reached.
+    bool m_occlusionCulling;
+    std::vector<uint8_t> findVisibleSections(const Camera& camera, const Frustum& frustum) const;
+    static int visibleIndex(int i, int j) {
+        return (i + RENDER_RADIUS) * (2 * RENDER_RADIUS + 1) + (j + RENDER_RADIUS);
+    }
+
+    void markDirty(const Coordinate& location);
+
+    // Meshes are built on the worker threads from a snapshot of the chunk and its
+    // neighbors. Every request for a section gets a new version number, and a
+    // finished mesh is only uploaded if it is still the latest version for its
+    // section when it arrives.
+    struct MeshResult {
+        int x, z, section;
+        uint64_t version;
+        ChunkMesher::SectionMesh mesh;
+    };
+
+    bool m_greedyMeshing;
+    uint64_t m_meshVersion;
+    CompletionQueue<MeshResult> m_finishedMeshes;
+    std::deque<MeshResult> m_uploadQueue;
+
+    // The chunk's neighbors must all be loaded
+    void requestMeshes(const Chunk* chunk, const std::vector<int>& sections);
+
+    // Uploads finished meshes to the GPU until the per-frame time budget runs out
+    void uploadMeshes();
+    void uploadMesh(std::unique_ptr<Mesh>& mesh, const MeshResult& result);
+
+    JobSystem m_jobSystem;
 };
 
 #endif
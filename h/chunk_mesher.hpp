@@ -0,0 +1,62 @@
+#ifndef CHUNK_MESHER_HPP
+#define CHUNK_MESHER_HPP
+
+#include <array>
+#include <vector>
+
+#include "chunk.hpp"
+#include "coordinate.hpp"
+#include "mesh.hpp"
+
+// Builds the vertices for sections of a chunk. The mesher keeps its own copy of
+// the chunk and its four neighbors, so that it can run on a worker thread while
+// the originals continue to be edited.
+class ChunkMesher {
+public:
+    // Neighbors are in the order +x, -x, +z, -z, and none of them may be null.
+    // A greedy mesher merges adjacent faces of the same type into larger quads.
+    ChunkMesher(const Chunk& chunk, const std::array<const Chunk*, 4>& neighbors, bool greedy);
+
+    struct SectionMesh {
+        // Opaque faces come first, followed by transparent faces
+        std::vector<Vertex> vertices;
+        size_t opaqueVertices, transparentVertices;
+    };
+
+    // Determine all triangles in each of the given sections which could
+    // possibly be visible
+    std::vector<SectionMesh> build(const std::vector<int>& sections) const;
+
+private:
+    // Access the snapshot. Locations outside of these five chunks are treated
+    // as not loaded.
+    const Chunk* getChunk(const Coordinate& location) const;
+
+    // The live faces of a block are the ones which are not hidden by a
+    // neighboring block. They are found for a whole column at once from the
+    // column occupancy words, so for each column and face direction (in the
+    // order of the cube mesh: +x, -x, +y, -y, +z, -z), bit k is set if that face
+    // of the block at height k is live.
+    typedef std::array<std::array<uint64_t, 6>, Chunk::SIZE * Chunk::SIZE> LiveFaces;
+    void findLiveFaces(LiveFaces& liveFaces) const;
+
+    // Bit i of the result is set if face i of the block at this location is live
+    unsigned int getLiveFaces(const LiveFaces& liveFaces, const Coordinate& r) const;
+
+    // True if a section and all six of its neighbors are opaque, so that it
+    // can't have any visible faces
+    bool isBuried(int section) const;
+
+    // Emits one quad per live face
+    void buildSimple(const LiveFaces& liveFaces, int section, SectionMesh& result) const;
+
+    // Merges the live faces in each plane of the section into as few rectangles
+    // as possible, as long as they have the same block type
+    void buildGreedy(const LiveFaces& liveFaces, int section, SectionMesh& result) const;
+
+    Chunk m_chunk;
+    std::vector<Chunk> m_neighbors;
+    bool m_greedy;
+};
+
+#endif
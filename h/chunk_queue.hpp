@@ -0,0 +1,52 @@
+#ifndef CHUNK_QUEUE_HPP
+#define CHUNK_QUEUE_HPP
+
+#include <cstddef>
+#include <set>
+#include <utility>
+#include <vector>
+
+// A binary heap of chunk locations, prioritized by their squared distance in
+// chunks from a center chunk which follows the camera. Moving the center only
+// marks the heap as stale, and the priorities are recomputed all at once the
+// next time a chunk is popped, so that crossing a chunk boundary costs one pass
+// over the queue rather than one per push.
+class ChunkQueue {
+public:
+    enum Order { NEAREST_FIRST, FARTHEST_FIRST };
+
+    explicit ChunkQueue(Order order = NEAREST_FIRST);
+
+    bool empty() const { return m_heap.empty(); }
+    size_t size() const { return m_heap.size(); }
+    bool contains(int x, int z) const { return m_members.count(std::make_pair(x, z)); }
+
+    // Does nothing if the chunk is already queued
+    void push(int x, int z);
+
+    // Removes and returns the chunk with the highest priority. The queue must
+    // not be empty.
+    std::pair<int, int> pop();
+
+    void setCenter(int x, int z);
+
+private:
+    struct Entry {
+        // Larger values are popped first
+        int priority;
+        int x, z;
+
+        bool operator<(const Entry& other) const { return priority < other.priority; }
+    };
+
+    int priority(int x, int z) const;
+
+    Order m_order;
+    int m_centerX, m_centerZ;
+    bool m_stale;
+
+    std::vector<Entry> m_heap;
+    std::set<std::pair<int, int>> m_members;
+};
+
+#endif
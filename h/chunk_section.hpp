@@ -0,0 +1,98 @@
+#ifndef CHUNK_SECTION_HPP
+#define CHUNK_SECTION_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "byte_stream.hpp"
+
+// A 16x16x16 cube of cells from a chunk, stored as indices into a small local
+// palette of block ids. Indices are packed at 0, 1, 2, 4 or 8 bits per cell,
+// whichever is the smallest that can address the palette, so a section of
+// nothing but air needs no cell storage at all. A section which was loaded from
+// a memory-mapped file may use the packed cells in the file directly, until the
+// first time that it is changed.
+class ChunkSection {
+public:
+    static const int SIZE = 1 << 4;    // Range of x and z dimensions
+    static const int HEIGHT = 1 << 4;  // Range of y dimension
+    static const size_t VOLUME = SIZE * SIZE * HEIGHT;
+
+    // A block id is EMPTY, or a block tag plus one
+    typedef uint8_t BlockId;
+    static constexpr BlockId EMPTY = 0;
+
+    ChunkSection();
+
+    // Copies share the cells of a mapped section rather than copying them
+    ChunkSection(const ChunkSection& other);
+    ChunkSection& operator=(const ChunkSection& other);
+    ChunkSection(ChunkSection&& other) = default;
+    ChunkSection& operator=(ChunkSection&& other) = default;
+
+    // Cells are laid out with y varying fastest. Arguments are relative to the
+    // section.
+    static size_t index(int i, int j, int k) { return (i * SIZE + j) * HEIGHT + k; }
+
+    BlockId get(size_t index) const;
+
+    // Widens the cell storage if value is not already in the palette
+    void set(size_t index, BlockId value);
+
+    // Replace the whole section from VOLUME ids in index() order, packed at the
+    // narrowest possible width
+    void assign(const BlockId* cells);
+
+    // Drop palette entries which are no longer used by any cell, narrowing the
+    // cell storage if possible
+    void compact();
+
+    // True if every cell holds the same id
+    bool isUniform() const { return m_bits == 0; }
+
+    // May return true for an id which has been overwritten since the last
+    // compaction
+    bool contains(BlockId value) const;
+
+    size_t bitsPerCell() const { return m_bits; }
+    size_t paletteSize() const { return m_palette.size(); }
+
+    // Heap memory used by this section, in bytes. Cells which are still in a
+    // mapped file don't count.
+    size_t memoryUsage() const;
+    bool isMapped() const { return m_mapping != nullptr; }
+
+    // The palette and the packed cells are saved as they are, with the cells
+    // aligned to 8 bytes from the start of out. read() replaces the section with
+    // one saved by write(), or returns false and leaves it alone if the data is
+    // malformed, including when a block id in the palette is above maxId. If a
+    // mapping is given, the data belongs to it, and the section refers to the
+    // cells in place where it can, keeping the mapping alive.
+    void write(std::vector<uint8_t>& out) const;
+    bool read(ByteReader& reader, BlockId maxId, std::shared_ptr<const void> mapping = nullptr);
+
+private:
+    // Repack every cell at the given width, which must be able to address the
+    // whole palette
+    void resize(size_t bits);
+
+    size_t paletteIndex(size_t index) const;
+    void setPaletteIndex(size_t index, size_t value);
+
+    // Copies the cells out of the mapped file before they are changed
+    void unmap();
+
+    std::vector<BlockId> m_palette;
+    size_t m_bits;
+
+    // Cells are never split across words, because each width divides 64. The
+    // words are either m_cells, or else in a mapped file which is kept open by
+    // m_mapping.
+    std::vector<uint64_t> m_cells;
+    std::shared_ptr<const void> m_mapping;
+    const uint64_t* m_words;
+};
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef CHUNK_STORE_HPP
+#define CHUNK_STORE_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "chunk.hpp"
+#include "completion_queue.hpp"
+#include "edit_log.hpp"
+#include "region_file.hpp"
+
+// Saves chunks to disk and loads them back. Chunks are grouped into region
+// files of 32x32 chunks each, and each chunk is compressed on its own. All of
+// the file access happens on a thread of its own, in the order that it was
+// requested, so a chunk which is saved and then loaded again always comes back
+// as it was saved.
+class ChunkStore {
+public:
+    // Compressed chunks take a fraction of the space, but have to be decoded into
+    // memory of their own when they're loaded. Uncompressed chunks are laid out
+    // on disk the way they are in memory, so a loaded chunk uses the block data
+    // straight from the mapped region file until it is first changed. With
+    // EDITS, only the edit logs of chunks are saved, and it is up to the caller
+    // to generate them again. Chunks saved in any format can be loaded whichever
+    // format is being saved.
+    enum Format { COMPRESSED, UNCOMPRESSED, EDITS };
+
+    // The directory is created if it doesn't exist yet
+    explicit ChunkStore(const std::string& directory, Format format = COMPRESSED);
+
+    // Waits for every save to be written
+    ~ChunkStore();
+
+    ChunkStore(const ChunkStore& other) = delete;
+    ChunkStore& operator=(const ChunkStore& other) = delete;
+
+    Format format() const { return m_format; }
+
+    // The seed of the world saved in the directory, and whether its terrain was
+    // made by the given generator (see Chunk::generatorId()). If there isn't a
+    // world there yet, one is started with the given seed and generator. A world
+    // saved without a generator id counts as a different generator.
+    struct World {
+        int seed;
+        bool sameGenerator;
+    };
+
+    static World loadWorld(const std::string& directory, int seed, uint64_t generator);
+
+    // Loads a chunk in the background. Every request gets a result from
+    // collectLoads(), with either the chunk or its edit log, or neither if it
+    // has never been saved.
+    struct LoadResult {
+        int x, z;
+        std::optional<Chunk> chunk;
+        std::optional<EditLog> edits;
+    };
+
+    void requestLoad(int x, int z);
+
+    // Calls f(LoadResult&&) for each load which has finished since the last call
+    template <typename F>
+    void collectLoads(F f) {
+        m_loaded.drain(f);
+    }
+
+    // Waits for everything requested so far, and then loads a chunk
+    LoadResult load(int x, int z);
+
+    // Writes a copy of the chunk, or of its edit log, in the background. A
+    // chunk is saved compressed in EDITS format.
+    void save(Chunk chunk);
+    void saveEdits(int x, int z, EditLog edits);
+
+private:
+    typedef std::function<void()> Task;
+    void submit(Task task);
+    void run();
+
+    // A saved chunk is well under this size before compression, so anything
+    // bigger must be corrupt
+    static const size_t MAX_CHUNK_SIZE = 1 << 16;
+
+    // These are only used by the I/O thread
+    LoadResult readChunk(int x, int z);
+    void writeChunk(const Chunk& chunk);
+    void writeEdits(int x, int z, EditLog& edits);
+    void writeData(int x, int z, const std::vector<uint8_t>& data);
+
+    // Region files are kept open once they've been used, up to a limit. Returns
+    // null if the file can't be opened.
+    static const size_t MAX_OPEN_REGIONS = 16;
+    RegionFile* region(int x, int z);
+
+    std::string m_directory;
+    Format m_format;
+    std::map<std::pair<int, int>, std::unique_ptr<RegionFile>> m_regions;
+
+    CompletionQueue<LoadResult> m_loaded;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeUp;
+    std::deque<Task> m_tasks;
+    bool m_stopping;
+
+    // Declared last, so that everything else exists before the thread starts
+    std::thread m_thread;
+};
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef COMPLETION_QUEUE_HPP
+#define COMPLETION_QUEUE_HPP
+
+#include <atomic>
+#include <utility>
+
+// A lock-free queue for handing results back from worker threads. Any number
+// of threads may push, but only one thread may drain.
+template <typename T>
+class CompletionQueue {
+public:
+    CompletionQueue() : m_head(nullptr) {}
+    ~CompletionQueue() {
+        drain([](T&&) {});
+    }
+
+    CompletionQueue(const CompletionQueue& other) = delete;
+    CompletionQueue& operator=(const CompletionQueue& other) = delete;
+
+    void push(T value) {
+        Node* node = new Node{std::move(value), m_head.load(std::memory_order_relaxed)};
+        while (!m_head.compare_exchange_weak(node->next, node, std::memory_order_release,
+                                             std::memory_order_relaxed)) {
+        }
+    }
+
+    // Calls f(T&&) on everything pushed since the last drain, in the order that
+    // it was pushed
+    template <typename F>
+    void drain(F f) {
+        // Taking the whole list at once means that a node can never be popped
+        // while another thread is looking at it
+        Node* node = m_head.exchange(nullptr, std::memory_order_acquire);
+
+        // The list is newest-first, so reverse it
+        Node* oldest = nullptr;
+        while (node) {
+            Node* next = node->next;
+            node->next = oldest;
+            oldest = node;
+            node = next;
+        }
+
+        while (oldest) {
+            Node* next = oldest->next;
+            f(std::move(oldest->value));
+            delete oldest;
+            oldest = next;
+        }
+    }
+
+private:
+    struct Node {
+        T value;
+        Node* next;
+    };
+
+    std::atomic<Node*> m_head;
+};
+
+#endif
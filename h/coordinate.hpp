@@ -24,4 +24,8 @@ std::ostream& operator<<(std::ostream& out, const Coordinate& r);
 bool operator<(const Coordinate& lhs, const Coordinate& rhs);
 bool operator==(const Coordinate& lhs, const Coordinate& rhs);
 
+// Integer division which rounds towards negative infinity, for finding the chunk
+// or region that a coordinate falls in
+inline int floorDiv(int a, int b) { return (a >= 0 ? a : a - (b - 1)) / b; }
+
 #endif
\ No newline at end of file
@@ -0,0 +1,62 @@
+#ifndef EDIT_LOG_HPP
+#define EDIT_LOG_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "block_library.hpp"
+#include "chunk.hpp"
+#include "coordinate.hpp"
+
+// The blocks of one chunk which have been changed since it was generated. Since
+// generation depends only on the seed, a chunk can be rebuilt from its edits
+// alone, which are usually a tiny fraction of its size.
+//
+// Edits are appended as they are made, and the log is compacted every so often
+// by sorting it by position and keeping only the last edit to each block, so
+// that it never grows much bigger than the number of blocks changed.
+class EditLog {
+public:
+    EditLog() : m_compactedSize(0) {}
+
+    // The new contents of a block, or nothing if it was removed
+    void record(const Coordinate& location, std::optional<BlockLibrary::Tag> tag);
+
+    bool empty() const { return m_edits.empty(); }
+    size_t size() const { return m_edits.size(); }
+
+    // Applies every edit to a freshly generated chunk. Edits which turn out to
+    // change nothing, such as a block placed and then removed again, are
+    // dropped from the log.
+    void apply(Chunk& chunk);
+
+    // Saved compacted, as a sorted list of positions and blocks. read() returns
+    // nothing if the data is malformed, including a block which isn't a type in
+    // the block library.
+    void write(std::vector<uint8_t>& out);
+    static std::optional<EditLog> read(const uint8_t* data, size_t size);
+
+private:
+    // Relative to the chunk, in the order that blocks are stored in a chunk
+    static const size_t POSITIONS = Chunk::SIZE * Chunk::SIZE * Chunk::DEPTH;
+    static_assert(POSITIONS <= 1 << 16, "Positions must fit in 16 bits");
+
+    // The block is a tag plus one, or zero if the block was removed
+    struct Edit {
+        uint16_t position;
+        uint8_t block;
+    };
+
+    // Only the last edit to each position is kept, in order of position
+    void compact();
+
+    std::vector<Edit> m_edits;
+
+    // The log is compacted whenever it doubles in size since it was last
+    // compacted
+    size_t m_compactedSize;
+};
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef FRACTAL_NOISE_HPP
+#define FRACTAL_NOISE_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <ratio>
+#include <utility>
+
+#include "perlin_noise.hpp"
+
+// Fractal Brownian motion: several octaves of Perlin noise added together, each
+// one sampled at Lacunarity times the frequency of the one before, and weighted
+// by Gain times its amplitude. The sum is divided by the total amplitude, so it
+// stays in the same range as a single octave, and with one octave it is exactly
+// the same as sampling the Perlin noise directly.
+//
+// The octaves are template parameters so that the loop over them is unrolled
+// at compile time, with every frequency and amplitude a constant.
+template <int OCTAVES, typename Lacunarity = std::ratio<2>, typename Gain = std::ratio<1, 2>>
+class FractalNoise {
+public:
+    static_assert(OCTAVES >= 1, "There must be at least one octave");
+
+    // Each octave has a generator of its own, so that the octaves don't line up
+    // with each other at the origin. The first octave uses the seed itself.
+    explicit FractalNoise(unsigned int seed) {
+        for (int i = 0; i < OCTAVES; ++i) {
+            m_octaves[i] = &PerlinNoise::forSeed(octaveSeed(seed, i));
+        }
+    }
+
+    float sample(float x, float y, float z) const {
+        return sample(x, y, z, std::make_integer_sequence<int, OCTAVES>());
+    }
+
+    // The same as sample() for each point, but the octaves are sampled a batch at
+    // a time with PerlinNoise's batched sampling
+    void sample(const float* x, const float* y, const float* z, size_t count, float* out) const;
+
+private:
+    static constexpr unsigned int octaveSeed(unsigned int seed, int octave) {
+        return seed ^ (octave * 0x9e3779b9u);
+    }
+
+    static constexpr float frequency(int octave) {
+        double result = 1.0;
+        for (int i = 0; i < octave; ++i) result *= double(Lacunarity::num) / Lacunarity::den;
+        return result;
+    }
+
+    static constexpr float amplitude(int octave) {
+        double result = 1.0;
+        for (int i = 0; i < octave; ++i) result *= double(Gain::num) / Gain::den;
+        return result;
+    }
+
+    static constexpr float normalization() {
+        double total = 0.0;
+        for (int i = 0; i < OCTAVES; ++i) total += amplitude(i);
+        return 1.0 / total;
+    }
+
+    // The scales of each octave are bound to constexpr locals, so that they are
+    // always evaluated at compile time
+    template <int OCTAVE>
+    float sampleOctave(float x, float y, float z) const {
+        constexpr float FREQUENCY = frequency(OCTAVE), AMPLITUDE = amplitude(OCTAVE);
+        return AMPLITUDE * m_octaves[OCTAVE]->sample(FREQUENCY * x, FREQUENCY * y, FREQUENCY * z);
+    }
+
+    template <int... OCTAVE>
+    float sample(float x, float y, float z, std::integer_sequence<int, OCTAVE...>) const {
+        constexpr float NORMALIZATION = normalization();
+
+        float result = 0.0f;
+        ((result += sampleOctave<OCTAVE>(x, y, z)), ...);
+
+        return OCTAVES == 1 ? result : result * NORMALIZATION;
+    }
+
+    // Points are sampled BATCH at a time, so that the scaled copies of them fit
+    // on the stack
+    static constexpr size_t BATCH = 256;
+
+    struct Batch {
+        float x[BATCH], y[BATCH], z[BATCH], samples[BATCH];
+    };
+
+    // Adds one octave of a batch of points onto out
+    template <int OCTAVE>
+    void addOctave(const float* x, const float* y, const float* z, size_t count, float* out,
+                   Batch& batch) const {
+        constexpr float FREQUENCY = frequency(OCTAVE), AMPLITUDE = amplitude(OCTAVE);
+        for (size_t i = 0; i < count; ++i) {
+            batch.x[i] = FREQUENCY * x[i];
+            batch.y[i] = FREQUENCY * y[i];
+            batch.z[i] = FREQUENCY * z[i];
+        }
+
+        m_octaves[OCTAVE]->sample(batch.x, batch.y, batch.z, count, batch.samples);
+        for (size_t i = 0; i < count; ++i) out[i] += AMPLITUDE * batch.samples[i];
+    }
+
+    template <int... OCTAVE>
+    void addOctaves(const float* x, const float* y, const float* z, size_t count, float* out,
+                    Batch& batch, std::integer_sequence<int, OCTAVE...>) const {
+        (addOctave<OCTAVE>(x, y, z, count, out, batch), ...);
+    }
+
+    std::array<const PerlinNoise*, OCTAVES> m_octaves;
+};
+
+template <int OCTAVES, typename Lacunarity, typename Gain>
+void FractalNoise<OCTAVES, Lacunarity, Gain>::sample(const float* x, const float* y,
+                                                     const float* z, size_t count,
+                                                     float* out) const {
+    // A single octave is just the Perlin noise, with nothing to add or scale
+    if constexpr (OCTAVES == 1) {
+        m_octaves[0]->sample(x, y, z, count, out);
+    } else {
+        constexpr float NORMALIZATION = normalization();
+
+        Batch batch;
+        std::fill(out, out + count, 0.0f);
+        for (size_t start = 0; start < count; start += BATCH) {
+            size_t n = std::min(BATCH, count - start);
+            addOctaves(x + start, y + start, z + start, n, out + start, batch,
+                       std::make_integer_sequence<int, OCTAVES>());
+        }
+
+        for (size_t i = 0; i < count; ++i) out[i] *= NORMALIZATION;
+    }
+}
+
+#endif
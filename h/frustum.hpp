@@ -0,0 +1,28 @@
+#ifndef FRUSTUM_HPP
+#define FRUSTUM_HPP
+
+#include <glm/glm.hpp>
+
+// The region of space visible through a view-projection matrix, as six planes
+// facing inwards. The planes are stored as separate arrays of components, so
+// that testing a box against all of them compiles to a few vector operations.
+class Frustum {
+public:
+    explicit Frustum(const glm::mat4& viewProjection);
+
+    // False only if the axis-aligned box is entirely outside of the frustum. A
+    // box near a corner of the frustum may be kept even though it is outside.
+    bool intersects(const glm::vec3& min, const glm::vec3& max) const;
+
+private:
+    static const int PLANES = 6;
+
+    // Padded to eight, with planes which never reject anything
+    static const int PADDED_PLANES = 8;
+    alignas(32) float m_x[PADDED_PLANES];
+    alignas(32) float m_y[PADDED_PLANES];
+    alignas(32) float m_z[PADDED_PLANES];
+    alignas(32) float m_w[PADDED_PLANES];
+};
+
+#endif
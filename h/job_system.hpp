@@ -0,0 +1,64 @@
+#ifndef JOB_SYSTEM_HPP
+#define JOB_SYSTEM_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed pool of worker threads for running jobs in the background. Each
+// worker has its own queue of jobs, and a worker whose queue is empty steals
+// from the others before going to sleep.
+class JobSystem {
+public:
+    typedef std::function<void()> Job;
+
+    // One thread per hardware thread, less one for the main thread
+    static size_t defaultThreadCount();
+
+    JobSystem(size_t threads = defaultThreadCount());
+    ~JobSystem();
+
+    JobSystem(const JobSystem& other) = delete;
+    JobSystem& operator=(const JobSystem& other) = delete;
+
+    size_t threadCount() const { return m_threads.size(); }
+
+    // Jobs submitted from the same thread are started in roughly the order they
+    // were submitted. Jobs which haven't started when the JobSystem is
+    // destroyed are never run.
+    void submit(Job job);
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    void run(size_t index);
+
+    // Takes the oldest job from this worker's own queue, or else the newest job
+    // from any other worker's queue
+    bool takeJob(size_t index, Job& job);
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::vector<std::thread> m_threads;
+
+    // Submitted jobs are spread across the workers round-robin
+    std::atomic<size_t> m_nextWorker;
+
+    // Idle workers sleep until there are queued jobs again. m_queued is only
+    // incremented with m_sleepMutex held, so that no wakeup is lost, and always
+    // before the job is pushed, so that it never counts fewer jobs than are
+    // queued.
+    std::mutex m_sleepMutex;
+    std::condition_variable m_wakeUp;
+    std::atomic<size_t> m_queued;
+    bool m_stopping;
+};
+
+#endif
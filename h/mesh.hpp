@@ -6,17 +6,29 @@
 #include <glm/glm.hpp>
 #include <vector>
 
+#include "buffer_arena.hpp"
+
+// Chunk vertices are packed into two words, and decoded by chunk-vertex.glsl.
+// The position is relative to the origin of the chunk, with x in bits 0-4, y
+// in bits 5-11 and z in bits 12-16. The chunk's own x and z coordinates are
+// kept modulo 128 in bits 17-23 and 24-30, which is enough to find the chunk
+// as long as it is within 64 chunks of the camera. The face of the cube (in
+// the order of the cube mesh) is in bits 0-2 of the texture word, and the
+// texture layer is in the remaining bits. The face determines the lighting and
+// the direction of the texture coordinates.
 struct Vertex {
-    GLfloat position[3];
-    GLfloat texCoord[3];
-    GLfloat lighting;
+    GLuint position;
+    GLuint texture;
 };
 
+Vertex packVertex(int chunkX, int chunkZ, const glm::ivec3& position, int face, int layer);
+
+// Each quad has four consecutive vertices, and every mesh is drawn with the
+// same index buffer, which splits quad i into the triangles (4i, 4i + 1, 4i + 2)
+// and (4i + 3, 4i + 2, 4i + 1). The opaque quads come before the transparent ones.
 struct Mesh {
-    GLuint vertexBuffer;
+    BufferArena::Allocation vertices;
     size_t opaqueVertices, transparentVertices;
 };
 
-void copyVector(GLfloat* dest, const glm::vec3& source);
-
 #endif
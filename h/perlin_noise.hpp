@@ -3,18 +3,39 @@
 
 #include <glm/gtc/noise.hpp>
 
+#include <cstddef>
+#include <cstdint>
+
 // Adapted from http://mrl.nyu.edu/~perlin/noise/
 class PerlinNoise {
 public:
     PerlinNoise(unsigned int seed = 0);
-    float sample(float x, float y, float z);
+
+    // A generator for the seed which is built once and then shared. Sampling
+    // doesn't change a generator, so it can be sampled from any number of
+    // threads at once.
+    static const PerlinNoise& forSeed(unsigned int seed);
+
+    float sample(float x, float y, float z) const;
+
+    // Samples the points (x[i], y[i], z[i]) for i < count into out[i], with
+    // exactly the same results as sample(). The points are blended several at a
+    // time with SSE2 or AVX2, whichever the CPU supports, so this is much faster
+    // than sampling them one at a time.
+    void sample(const float* x, const float* y, const float* z, size_t count, float* out) const;
 
 private:
-    float fade(float t);
-    float lerp(float t, float a, float b);
-    float grad(int hash, float x, float y, float z);
+    // Finds the hashes of the 8 corners of the unit cube at (X, Y, Z), with
+    // corner c offset by (c & 1, (c >> 1) & 1, c >> 2). blend() interpolates
+    // between the corners for a point (x, y, z) within the cube.
+    void hash(uint8_t X, uint8_t Y, uint8_t Z, int hashes[8]) const;
+    static float blend(float x, float y, float z, const int hashes[8]);
+
+    static float fade(float t);
+    static float lerp(float t, float a, float b);
+    static float grad(int hash, float x, float y, float z);
 
     uint8_t p[512];
 };
 
-#endif
\ No newline at end of file
+#endif
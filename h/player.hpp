@@ -31,6 +31,11 @@ public:
 
     void update(float elapsed);
 
+    // A box containing every block that the player could touch during the next
+    // update, ignoring collisions. These blocks have to be loaded before the
+    // update, or else the player could fall or walk through them.
+    void reach(float elapsed, glm::vec3& min, glm::vec3& max) const;
+
     const Camera& camera() const { return m_camera; }
 
     // Calls the private potentialIntersections with the current position
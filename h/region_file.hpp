@@ -0,0 +1,92 @@
+#ifndef REGION_FILE_HPP
+#define REGION_FILE_HPP
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+// The saved chunks of a 32x32 region of the world, in a single file. The file
+// starts with a table giving the location and size of each chunk's data, and
+// the data itself is stored in whole sectors, so that a chunk which is saved
+// again can usually be overwritten in place. The contents of each chunk are
+// opaque to this class.
+//
+// Chunks are read straight out of a read-only memory mapping of the file, which
+// loaded chunks may keep using for as long as they like. Sectors are never
+// overwritten while any mapping of the file is still in use, so the data that a
+// loaded chunk refers to doesn't change underneath it.
+class RegionFile {
+public:
+    static const int SIZE = 32;
+    static const size_t SECTOR_SIZE = 4096;
+
+    // Opens the file, creating it if it doesn't exist yet
+    explicit RegionFile(const std::string& path);
+    ~RegionFile();
+
+    RegionFile(const RegionFile& other) = delete;
+    RegionFile& operator=(const RegionFile& other) = delete;
+
+    bool isOpen() const { return m_file != nullptr; }
+
+    // True if anything other than this object holds a mapping of the file. A
+    // file must not be closed and opened again while it is in use, since the new
+    // object wouldn't know which sectors are still being used.
+    bool inUse();
+
+    // The saved data of a chunk, which stays valid for as long as the mapping is
+    // held. The data starts on a sector boundary.
+    struct Data {
+        std::shared_ptr<const void> mapping;
+        const uint8_t* bytes;
+        size_t size;
+    };
+
+    // Chunks are identified by their position (i, j) within the region. read()
+    // returns false if the chunk has never been saved, and write() returns false
+    // if the file couldn't be written.
+    bool read(int i, int j, Data& data);
+    bool write(int i, int j, const std::vector<uint8_t>& data);
+
+private:
+    // Each entry of the table is a sector number and a size in bytes. A sector
+    // number of zero means that the chunk hasn't been saved, since the table
+    // itself comes first.
+    struct Entry {
+        uint32_t sector, size;
+    };
+
+    static const size_t ENTRY_SIZE = 8;
+    static const size_t TABLE_SECTORS = SIZE * SIZE * ENTRY_SIZE / SECTOR_SIZE;
+
+    static size_t sectorsFor(size_t bytes) { return (bytes + SECTOR_SIZE - 1) / SECTOR_SIZE; }
+
+    // Finds a run of free sectors, which may extend past the end of the file
+    size_t findSectors(size_t count) const;
+    void markSectors(size_t first, size_t count, bool used);
+
+    // Sectors which are freed while the file is in use are retired instead, and
+    // only become free once it is no longer in use
+    void freeSectors(size_t first, size_t count);
+    std::vector<std::pair<size_t, size_t>> m_retiredSectors;
+
+    bool writeEntry(int index);
+
+    std::FILE* m_file;
+    std::array<Entry, SIZE * SIZE> m_table;
+
+    // Whether each sector of the file is in use
+    std::vector<bool> m_usedSectors;
+
+    // The whole file is mapped, and mapped again whenever a read goes past the
+    // end of the mapping. Replaced mappings may still be in use.
+    bool map();
+    std::shared_ptr<const void> m_mapping;
+    size_t m_mappedSize;
+    std::vector<std::weak_ptr<const void>> m_oldMappings;
+};
+
+#endif
@@ -28,8 +28,10 @@ public:
 
     const BlockLibrary& blockLibrary() const { return *m_blockLibrary; }
 
+    // Transforms world coordinates to clip coordinates for the given camera
+    glm::mat4 viewProjectionMatrix(const Camera& camera) const;
+
 private:
-    void buildViewProjectionMatrix(const Camera& camera) const;
 
     int m_width, m_height;
     glm::mat4 m_projection;
@@ -43,12 +45,40 @@ private:
         GLuint programId;
 
         // Shader input variables
-        GLint position, texCoord, lighting;
+        GLint position, texture;
 
         // Shader uniform variables
         GLint modelMatrix, vpMatrix, highlight, textureSampler;
         GLint resolution, sunPosition, brightness;
+        GLint cameraChunk, faceLighting;
+
+        // The shared index buffer for chunk meshes (see Mesh), large enough for a
+        // section with every face of every block visible
+        GLuint indexBuffer;
+
+        // Holds the draw commands for each frame, if indirect drawing is supported
+        GLuint indirectBuffer;
     } m_chunkShader;
+    static const size_t MAX_QUADS = 6 * ChunkSection::VOLUME;
+
+    // Chunk meshes are drawn in batches of meshes which share a vertex buffer,
+    // with one multi-draw call per batch. The commands are laid out for
+    // glMultiDrawElementsIndirect, and passed as arrays to
+    // glMultiDrawElementsBaseVertex when indirect drawing isn't available.
+    struct DrawCommand {
+        GLuint count, instanceCount, firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+
+    struct Batch {
+        GLuint buffer;
+        size_t first, count;
+    };
+
+    bool m_drawIndirect;
+    std::vector<DrawCommand> m_drawCommands;
+    void drawBatches(const std::vector<Batch>& batches);
 
     // Shader program for tinting the screen (for example,
     // when underwater).
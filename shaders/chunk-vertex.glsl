@@ -4,9 +4,16 @@ uniform mat4 vpMatrix;
 uniform vec3 sunPosition;
 uniform float brightness;
 
-in vec3 position;
-in vec3 texCoord;
-in float lighting;
+// The chunk containing the camera. Vertices only know their own chunk modulo
+// 128, so this picks out the nearest chunk with those coordinates.
+uniform ivec2 cameraChunk;
+
+// Lighting of each face of a cube, in the order of the cube mesh
+uniform float faceLighting[6];
+
+// See Vertex in mesh.hpp for the packing
+in uint packedPosition;
+in uint packedTexture;
 
 out float fragLighting;
 out float fogFactor;
@@ -14,10 +21,29 @@ out vec3 fragTexCoord;
 
 void main()
 {
-	fragTexCoord = texCoord;
-	fragLighting = lighting;
+	vec3 local = vec3(packedPosition & 31u, (packedPosition >> 5) & 127u,
+	                  (packedPosition >> 12) & 31u);
+	ivec2 chunk = ivec2((packedPosition >> 17) & 127u, (packedPosition >> 24) & 127u);
+	chunk = cameraChunk + ((chunk - cameraChunk + 64) & 127) - 64;
+	vec3 chunkOrigin = 16.0 * vec3(chunk.x, 0.0, chunk.y);
 
-	gl_Position = vpMatrix * vec4(position, 1.0);
-	fogFactor = clamp((length(gl_Position) - 90.0) / 90.0, 0.0, 1.0);
-}
+	uint face = packedTexture & 7u;
+	float layer = float(packedTexture >> 3);
 
+	// Texture coordinates follow the two axes spanning the face, in the same
+	// directions as the cube mesh. The texture repeats, so only the fractional
+	// part matters, and a greedy quad gets one copy of the texture per block.
+	vec2 uv;
+	if (face < 2u)
+		uv = vec2(local.z, -local.y);
+	else if (face < 4u)
+		uv = local.xz;
+	else
+		uv = vec2(local.x, -local.y);
+
+	fragTexCoord = vec3(uv, layer);
+	fragLighting = faceLighting[face];
+
+	gl_Position = vpMatrix * vec4(chunkOrigin + local, 1.0);
+	fogFactor = clamp((length(gl_Position) - 90.0) / 90.0, 0.0, 1.0);
+}
\ No newline at end of file
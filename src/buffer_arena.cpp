@@ -0,0 +1,196 @@
+#include "buffer_arena.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+
+BufferArena::BufferArena(size_t elementSize, size_t pageElements)
+: m_elementSize(elementSize), m_pageElements(pageElements), m_allocations(0), m_generation(0) {}
+
+BufferArena::~BufferArena() {
+    for (auto& entry : m_pages) glDeleteBuffers(1, &entry.first);
+}
+
+size_t BufferArena::roundUp(size_t count) {
+    return std::max<size_t>(1, (count + GRANULARITY - 1) / GRANULARITY) * GRANULARITY;
+}
+
+BufferArena::Allocation BufferArena::allocate(size_t count) {
+    count = roundUp(count);
+
+    Allocation allocation;
+    if (allocateExisting(count, 0, allocation)) return allocation;
+
+    // No room anywhere, so start a new buffer
+    Page page;
+    page.capacity = std::max(m_pageElements, count);
+    page.used = 0;
+    page.freeRanges[0] = page.capacity;
+
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBufferData(GL_ARRAY_BUFFER, page.capacity * m_elementSize, nullptr, GL_DYNAMIC_DRAW);
+
+    Page& inserted = m_pages[buffer] = page;
+    bool success = allocateFrom(buffer, inserted, count, allocation);
+    assert(success);
+    (void)success;
+
+    return allocation;
+}
+
+bool BufferArena::allocateExisting(size_t count, GLuint exclude, Allocation& allocation) {
+    for (auto& entry : m_pages) {
+        if (entry.first != exclude && allocateFrom(entry.first, entry.second, count, allocation)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool BufferArena::allocateFrom(GLuint buffer, Page& page, size_t count, Allocation& allocation) {
+    for (auto i = page.freeRanges.begin(); i != page.freeRanges.end(); ++i) {
+        if (i->second < count) continue;
+
+        allocation.buffer = buffer;
+        allocation.first = i->first;
+        allocation.count = count;
+
+        size_t remaining = i->second - count;
+        page.freeRanges.erase(i);
+        if (remaining > 0) page.freeRanges[allocation.first + count] = remaining;
+
+        page.used += count;
+        ++m_allocations;
+        ++m_generation;
+        return true;
+    }
+
+    return false;
+}
+
+void BufferArena::free(const Allocation& allocation) {
+    if (!allocation.buffer) return;
+
+    release(allocation);
+    dropIfEmpty(allocation.buffer);
+}
+
+void BufferArena::release(const Allocation& allocation) {
+    auto entry = m_pages.find(allocation.buffer);
+    assert(entry != m_pages.end());
+    Page& page = entry->second;
+
+    page.used -= allocation.count;
+    --m_allocations;
+    ++m_generation;
+
+    // Merge with the free ranges on either side
+    size_t first = allocation.first, count = allocation.count;
+    auto next = page.freeRanges.lower_bound(first);
+    if (next != page.freeRanges.end() && next->first == first + count) {
+        count += next->second;
+        next = page.freeRanges.erase(next);
+    }
+
+    if (next != page.freeRanges.begin()) {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second == first) {
+            first = previous->first;
+            count += previous->second;
+            page.freeRanges.erase(previous);
+        }
+    }
+
+    page.freeRanges[first] = count;
+}
+
+void BufferArena::dropIfEmpty(GLuint buffer) {
+    // Keep one buffer around even when it's empty, since it will be needed again
+    auto entry = m_pages.find(buffer);
+    if (entry->second.used == 0 && m_pages.size() > 1) {
+        glDeleteBuffers(1, &entry->first);
+        m_pages.erase(entry);
+    }
+}
+
+void BufferArena::reallocate(Allocation& allocation, size_t count) {
+    if (allocation.buffer && count <= allocation.count && 2 * count > allocation.count) return;
+    if (!allocation.buffer) {
+        allocation = allocate(count);
+        return;
+    }
+
+    // The old range is given back first but its buffer is kept, so that the new
+    // range can reuse it, or the space around it, instead of a new buffer being
+    // created just after the old one was deleted. The contents aren't kept.
+    GLuint buffer = allocation.buffer;
+    release(allocation);
+
+    Allocation result;
+    if (!allocateFrom(buffer, m_pages[buffer], roundUp(count), result)) {
+        result = allocate(count);
+        dropIfEmpty(buffer);
+    }
+
+    allocation = result;
+}
+
+void BufferArena::upload(const Allocation& allocation, const void* data, size_t count) {
+    assert(count <= allocation.count);
+
+    glBindBuffer(GL_ARRAY_BUFFER, allocation.buffer);
+    glBufferSubData(GL_ARRAY_BUFFER, allocation.first * m_elementSize, count * m_elementSize,
+                    data);
+}
+
+GLuint BufferArena::fragmentedBuffer() const {
+    if (m_pages.size() < 2) return 0;
+
+    // The emptiest buffer is worth emptying if it is less than a quarter full,
+    // and everything in it fits in the free space of the other buffers
+    size_t totalFree = 0;
+    const std::pair<const GLuint, Page>* emptiest = nullptr;
+    for (const auto& entry : m_pages) {
+        const Page& page = entry.second;
+        totalFree += page.capacity - page.used;
+
+        if (!emptiest || page.used * emptiest->second.capacity <
+                             emptiest->second.used * page.capacity) {
+            emptiest = &entry;
+        }
+    }
+
+    const Page& page = emptiest->second;
+    size_t otherFree = totalFree - (page.capacity - page.used);
+    if (4 * page.used < page.capacity && page.used <= otherFree) return emptiest->first;
+
+    return 0;
+}
+
+bool BufferArena::relocate(Allocation& allocation) {
+    Allocation result;
+    if (!allocateExisting(allocation.count, allocation.buffer, result)) return false;
+
+    glBindBuffer(GL_COPY_READ_BUFFER, allocation.buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, result.buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                        allocation.first * m_elementSize, result.first * m_elementSize,
+                        allocation.count * m_elementSize);
+
+    free(allocation);
+    allocation = result;
+    return true;
+}
+
+BufferArena::Stats BufferArena::stats() const {
+    Stats result = {m_pages.size(), m_allocations, 0, 0};
+    for (const auto& entry : m_pages) {
+        result.capacity += entry.second.capacity * m_elementSize;
+        result.used += entry.second.used * m_elementSize;
+    }
+
+    return result;
+}
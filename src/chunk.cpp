@@ -1,130 +1,473 @@
 #include "chunk.hpp"
 
-#include <cstdlib>
-#include <ctime>
+#include <algorithm>
+#include <bitset>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <vector>
 
-#include "perlin_noise.hpp"
+#include "fractal_noise.hpp"
 
-Chunk::Chunk(int x, int z, unsigned int seed) : m_x(x), m_z(z) {
-    PerlinNoise heightMap(seed);
-    PerlinNoise noise(seed + 1);
-    PerlinNoise caves(seed + 2);
+// The octaves of each noise field. The height map is only a single layer of
+// samples, so extra octaves cost little there, while every octave of the 3D
+// fields is another sample for every cell. Changing these changes the terrain,
+// so Chunk::GENERATOR_VERSION has to be bumped with them.
+typedef FractalNoise<4> HeightNoise;
+typedef FractalNoise<2> DensityNoise;
+typedef FractalNoise<1> CaveNoise;
 
-    // Lower means more mountains and valleys
-    const float SMOOTHNESS = 25.0;
+// The height of the top block in a column mask, or -1 if the column is empty
+static int highestBit(uint64_t column) {
+    return column ? 63 - __builtin_clzll(column) : -1;
+}
+
+// Samples a noise field at every cell of a chunk, at the cell's world position
+// times scale, with the cells in the same order as the blocks in the generation
+// buffer. With a coarse lattice, the field is sampled at the corners of each
+// lattice cell, which are shared with the neighboring chunks, and is trilinearly
+// interpolated in between.
+template <typename Noise>
+static void sampleField(const Noise& noise, int x, int z, const glm::vec3& scale,
+                        const Chunk::NoiseLattice& lattice, std::vector<float>& field) {
+    const int SIZE = Chunk::SIZE, DEPTH = Chunk::DEPTH;
+    assert(lattice.valid());
+
+    int nx = SIZE / lattice.x + 1, ny = DEPTH / lattice.y + 1, nz = SIZE / lattice.z + 1;
+    if (lattice.x == 1 && lattice.y == 1 && lattice.z == 1) {
+        // Sampling every cell exactly needs no points past the edge of the chunk
+        nx = nz = SIZE;
+        ny = DEPTH;
+    }
 
-    // Larger means flatter
-    const float DETAIL = 1 / 16.0;
+    std::vector<float> px(nx * ny * nz), py(nx * ny * nz), pz(nx * ny * nz);
+    for (int a = 0; a < nx; ++a) {
+        for (int c = 0; c < nz; ++c) {
+            for (int b = 0; b < ny; ++b) {
+                int point = (a * nz + c) * ny + b;
+                px[point] = scale.x * (x * SIZE + a * lattice.x);
+                py[point] = scale.y * (b * lattice.y);
+                pz[point] = scale.z * (z * SIZE + c * lattice.z);
+            }
+        }
+    }
 
-    // Larger means more overhangs and caves
-    const float CARVING = 2.0;
+    field.resize(SIZE * SIZE * DEPTH);
+    if (nx == SIZE && ny == DEPTH && nz == SIZE) {
+        noise.sample(px.data(), py.data(), pz.data(), px.size(), field.data());
+        return;
+    }
 
-    // Larger means more caves
-    const float CAVES = 3.0;
+    std::vector<float> samples(px.size());
+    noise.sample(px.data(), py.data(), pz.data(), px.size(), samples.data());
 
+    auto lerp = [](float t, float a, float b) { return a + t * (b - a); };
     for (int i = 0; i < SIZE; ++i) {
+        int a = i / lattice.x;
+        float u = float(i % lattice.x) / lattice.x;
+
         for (int j = 0; j < SIZE; ++j) {
-            float heightSample =
-                heightMap.sample(SMOOTHNESS * (x * SIZE + i), 0.0, SMOOTHNESS * (z * SIZE + j));
-            float height = (DEPTH / 2) + SCALE * heightSample;  //(0.5 + 0.25 * heightSample);
+            int c = j / lattice.z;
+            float w = float(j % lattice.z) / lattice.z;
 
+            // The four lattice columns around this column of cells
+            const float* s00 = &samples[(a * nz + c) * ny];
+            const float* s10 = s00 + nz * ny;
+            const float* s01 = s00 + ny;
+            const float* s11 = s10 + ny;
+
+            float* column = &field[(i * SIZE + j) * DEPTH];
             for (int k = 0; k < DEPTH; ++k) {
-                float sample = noise.sample(DETAIL * (x * SIZE + i), CARVING * DETAIL * k,
-                                            DETAIL * (z * SIZE + j));
-                sample += (height - k) / (SCALE / 4.0);
-
-                // Ground threshold
-                if (sample > 0.0f) {
-                    // Stone threshold
-                    if (sample > 0.5f)
-                        newBlock(x * SIZE + i, k, z * SIZE + j, BlockLibrary::STONE);
-                    else
-                        newBlock(x * SIZE + i, k, z * SIZE + j, BlockLibrary::DIRT);
-                }
+                int b = k / lattice.y;
+                float v = float(k % lattice.y) / lattice.y;
+
+                float bottom = lerp(w, lerp(u, s00[b], s10[b]), lerp(u, s01[b], s11[b]));
+                float top =
+                    lerp(w, lerp(u, s00[b + 1], s10[b + 1]), lerp(u, s01[b + 1], s11[b + 1]));
+                column[k] = lerp(v, bottom, top);
             }
         }
     }
+}
+
+// A 64-bit FNV-1a hash of the generator version and every field of the config
+uint64_t Chunk::generatorId(const TerrainConfig& terrain) {
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&hash](uint32_t value) {
+        for (int i = 0; i < 4; ++i) {
+            hash = (hash ^ ((value >> (8 * i)) & 0xff)) * 1099511628211ull;
+        }
+    };
+
+    auto addFloat = [&add](float value) {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        add(bits);
+    };
+
+    add(GENERATOR_VERSION);
+    addFloat(terrain.hillFrequency);
+    addFloat(terrain.hillHeight);
+    addFloat(terrain.detailFrequency);
+    addFloat(terrain.carving);
+    addFloat(terrain.caves);
+    addFloat(terrain.falloff);
+    addFloat(terrain.stone);
+    addFloat(terrain.seaLevel);
+    addFloat(terrain.caveThreshold);
+    add(terrain.lattice.x);
+    add(terrain.lattice.y);
+    add(terrain.lattice.z);
+
+    return hash;
+}
+
+Chunk::Chunk(int x, int z, unsigned int seed, const TerrainConfig& terrain) : m_x(x), m_z(z) {
+    HeightNoise heightMap(seed);
+    DensityNoise noise(seed + 1);
+    CaveNoise caves(seed + 2);
+
+    // The terrain is generated into a dense buffer laid out section by section,
+    // so that each section can be packed straight out of it. The noise fields
+    // are laid out column by column, with y varying fastest.
+    std::vector<BlockId> blocks(SECTIONS * ChunkSection::VOLUME, EMPTY);
+    auto cell = [&blocks](int i, int j, int k) -> BlockId& {
+        return blocks[(k / SECTION_HEIGHT) * ChunkSection::VOLUME +
+                      ChunkSection::index(i, j, k % SECTION_HEIGHT)];
+    };
+    auto index = [](int i, int j, int k) { return (i * SIZE + j) * DEPTH + k; };
 
-    // Convert top-level dirt to grass
+    // Noise is sampled a whole grid or field at a time, which is much faster
+    // than one point at a time
+    float heightX[SIZE * SIZE], heightY[SIZE * SIZE], heightZ[SIZE * SIZE];
     for (int i = 0; i < SIZE; ++i) {
         for (int j = 0; j < SIZE; ++j) {
-            // Fill any gap below sea level with water
-            for (int k = 0; k < 0.45 * DEPTH; ++k) {
-                Coordinate location(x * SIZE + i, k, z * SIZE + j);
-                if (!get(location)) {
-                    newBlock(location.x, location.y, location.z, BlockLibrary::WATER);
-                }
-            }
+            heightX[i * SIZE + j] = terrain.hillFrequency * (x * SIZE + i);
+            heightY[i * SIZE + j] = 0.0;
+            heightZ[i * SIZE + j] = terrain.hillFrequency * (z * SIZE + j);
         }
     }
 
-    // Cut out some caves
+    float heightSamples[SIZE * SIZE];
+    heightMap.sample(heightX, heightY, heightZ, SIZE * SIZE, heightSamples);
+
+    float detail = terrain.detailFrequency;
+    std::vector<float> noiseField, caveField;
+    sampleField(noise, x, z, glm::vec3(detail, terrain.carving * detail, detail), terrain.lattice,
+                noiseField);
+    sampleField(caves, x, z, glm::vec3(detail, terrain.caves * detail, detail), terrain.lattice,
+                caveField);
+
     for (int i = 0; i < SIZE; ++i) {
         for (int j = 0; j < SIZE; ++j) {
-            for (int k = 0; k < DEPTH; ++k) {
-                Coordinate location(x * SIZE + i, k, z * SIZE + j);
-                if (m_blocks.find(location) == m_blocks.end()) continue;
+            float heightSample = heightSamples[i * SIZE + j];
+            float height = (DEPTH / 2) + terrain.hillHeight * heightSample;
 
-                float caveSample = caves.sample(DETAIL * (x * SIZE + i), CAVES * DETAIL * k,
-                                                DETAIL * (z * SIZE + j));
-                caveSample = pow(caveSample, 3.0);
+            // Each column is built in a single pass from the top down, so the
+            // first block found is the top of the column, and every block is
+            // decided in full before it is written
+            int top = -1, ground = -1;
+            uint64_t& opaque = m_opaqueColumns[i * SIZE + j];
+            opaque = 0;
+            for (int k = DEPTH - 1; k >= 0; --k) {
+                float sample = noiseField[index(i, j, k)];
+                sample += (height - k) / terrain.falloff;
 
-                // Ground threshold
-                if (caveSample <= -0.1) {
-                    removeBlock(location);
+                // Ground and stone thresholds, with any gap below sea level
+                // filled with water
+                BlockId block = EMPTY;
+                if (sample > terrain.stone) {
+                    block = BlockLibrary::STONE + 1;
+                } else if (sample > 0.0f) {
+                    block = BlockLibrary::DIRT + 1;
+                } else if (k < terrain.seaLevel) {
+                    block = BlockLibrary::WATER + 1;
                 }
-            }
 
-            // Convert top-level dirt to grass
-            for (int k = DEPTH - 1; k >= 0; --k) {
-                Coordinate location(x * SIZE + i, k, z * SIZE + j);
+                if (block == EMPTY) continue;
+
+                // Cut out some caves
+                float caveSample = pow(caveField[index(i, j, k)], 3.0);
+                if (caveSample <= terrain.caveThreshold) continue;
 
-                if (get(location)) {
-                    auto& block = m_blocks[location];
-                    if (block->blockType == BlockLibrary::DIRT)
-                        block->blockType = BlockLibrary::GRASS;
+                if (top < 0) top = k;
 
-                    // We only work on the top-most block in a column.
-                    break;
+                // Convert top-level dirt to grass. We only work on the top-most
+                // block in a column, so not on anything under water.
+                if (block != BlockLibrary::WATER + 1 && ground < 0) {
+                    ground = k;
+                    if (ground == top && block == BlockLibrary::DIRT + 1) {
+                        block = BlockLibrary::GRASS + 1;
+                    }
                 }
+
+                cell(i, j, k) = block;
+                if (block != BlockLibrary::WATER + 1) opaque |= uint64_t(1) << k;
             }
         }
     }
+
+    for (int s = 0; s < SECTIONS; ++s) {
+        m_sections[s].assign(&blocks[s * ChunkSection::VOLUME]);
+        updateSectionFlags(s);
+        updateConnectivity(s);
+    }
+}
+
+Chunk::Chunk(int x, int z, Empty) : m_x(x), m_z(z) {
+    m_opaqueColumns.fill(0);
+    for (int s = 0; s < SECTIONS; ++s) {
+        updateSectionFlags(s);
+        updateConnectivity(s);
+    }
+}
+
+void Chunk::write(std::vector<uint8_t>& out) const {
+    putInteger(out, FORMAT_VERSION);
+    putInteger<int32_t>(out, m_x);
+    putInteger<int32_t>(out, m_z);
+    for (uint64_t opaque : m_opaqueColumns) putInteger<int8_t>(out, highestBit(opaque));
+
+    for (const ChunkSection& section : m_sections) section.write(out);
+}
+
+std::optional<Chunk> Chunk::read(const uint8_t* data, size_t size,
+                                 std::shared_ptr<const void> mapping) {
+    ByteReader reader(data, size);
+    uint8_t version = reader.getInteger<uint8_t>();
+    if (version != FORMAT_VERSION) return std::nullopt;
+
+    int x = reader.getInteger<int32_t>();
+    int z = reader.getInteger<int32_t>();
+    Chunk chunk(x, z, Empty());
+    // A column with nothing opaque in it has a height of -1
+    std::array<int8_t, SIZE * SIZE> heights;
+    for (int8_t& height : heights) height = reader.getInteger<int8_t>();
+
+    // Block ids are tags plus one
+    for (int s = 0; s < SECTIONS; ++s) {
+        if (!chunk.m_sections[s].read(reader, BlockLibrary::TYPES, mapping)) return std::nullopt;
+
+        chunk.updateSectionFlags(s);
+        chunk.updateConnectivity(s);
+    }
+
+    if (reader.failed() || !reader.atEnd()) return std::nullopt;
+
+    // The columns are rebuilt from the blocks, and the saved heights must agree
+    // with them
+    for (int i = 0; i < SIZE; ++i) {
+        for (int j = 0; j < SIZE; ++j) {
+            uint64_t opaque = chunk.column(x * SIZE + i, z * SIZE + j).opaque;
+            if (highestBit(opaque) != heights[i * SIZE + j]) return std::nullopt;
+
+            chunk.m_opaqueColumns[i * SIZE + j] = opaque;
+        }
+    }
+
+    return chunk;
 }
 
-const Block* Chunk::get(const Coordinate& location) const {
-    auto i = m_blocks.find(location);
-    if (i == m_blocks.end()) {
-        return nullptr;
+bool Chunk::locate(const Coordinate& location, int& section, size_t& index) const {
+    int i = location.x - m_x * SIZE;
+    int j = location.z - m_z * SIZE;
+    int k = location.y;
+
+    if (i < 0 || i >= SIZE || j < 0 || j >= SIZE || k < 0 || k >= DEPTH) return false;
+
+    section = k / SECTION_HEIGHT;
+    index = ChunkSection::index(i, j, k % SECTION_HEIGHT);
+    return true;
+}
+
+std::optional<BlockLibrary::Tag> Chunk::get(const Coordinate& location) const {
+    int section;
+    size_t index;
+    if (!locate(location, section, index)) return std::nullopt;
+
+    BlockId id = m_sections[section].get(index);
+    if (id == EMPTY) {
+        return std::nullopt;
     } else {
-        return i->second.get();
+        return id - 1;
     }
 }
 
+// Edits are rare, so the palette is compacted after every one to keep it from
+// accumulating block types which are no longer present.
 void Chunk::newBlock(int x, int y, int z, BlockLibrary::Tag tag) {
     Coordinate location(x, y, z);
-    m_blocks[location] = std::unique_ptr<Block>(new Block(location, tag));
+
+    int section;
+    size_t index;
+    if (locate(location, section, index)) {
+        m_sections[section].set(index, tag + 1);
+        m_sections[section].compact();
+        updateSectionFlags(section);
+        updateConnectivity(section);
+        updateHeight(location);
+    }
+}
+
+void Chunk::removeBlock(const Coordinate& location) {
+    int section;
+    size_t index;
+    if (locate(location, section, index)) {
+        m_sections[section].set(index, EMPTY);
+        m_sections[section].compact();
+        updateSectionFlags(section);
+        updateConnectivity(section);
+        updateHeight(location);
+    }
+}
+
+int Chunk::height(int x, int z) const {
+    int i = x - m_x * SIZE;
+    int j = z - m_z * SIZE;
+    if (i < 0 || i >= SIZE || j < 0 || j >= SIZE) return -1;
+
+    return highestBit(m_opaqueColumns[i * SIZE + j]);
+}
+
+void Chunk::updateHeight(const Coordinate& location) {
+    uint64_t& opaque =
+        m_opaqueColumns[(location.x - m_x * SIZE) * SIZE + location.z - m_z * SIZE];
+    uint64_t bit = uint64_t(1) << location.y;
+
+    if (isTransparent(location)) {
+        opaque &= ~bit;
+    } else {
+        opaque |= bit;
+    }
 }
 
-void Chunk::removeBlock(const Coordinate& location) { m_blocks.erase(location); }
+void Chunk::updateSectionFlags(int s) {
+    const ChunkSection& section = m_sections[s];
+
+    uint8_t flags = 0;
+    if (section.isUniform() && section.get(0) == EMPTY) flags |= EMPTY_SECTION;
+    if (!section.contains(EMPTY) && !section.contains(BlockLibrary::WATER + 1))
+        flags |= OPAQUE_SECTION;
+
+    m_sectionFlags[s] = flags;
+}
+
+void Chunk::updateConnectivity(int s) {
+    std::array<uint8_t, 6>& connectivity = m_connectivity[s];
+
+    const uint8_t ALL_FACES = (1 << 6) - 1;
+    if (isSectionEmpty(s) || isSectionOpaque(s)) {
+        connectivity.fill(isSectionEmpty(s) ? ALL_FACES : 0);
+        return;
+    }
+
+    // Flood fill each connected region of non-opaque cells, and join together all
+    // of the faces that it touches. Opaque cells start out marked as visited.
+    const ChunkSection& section = m_sections[s];
+    std::bitset<ChunkSection::VOLUME> visited;
+    for (size_t index = 0; index < ChunkSection::VOLUME; ++index) {
+        BlockId id = section.get(index);
+        visited[index] = (id != EMPTY && id != BlockLibrary::WATER + 1);
+    }
+
+    connectivity.fill(0);
+
+    // Cells are in index() order, so the neighbors in x, z and y are this far apart
+    const int DX = SIZE * SECTION_HEIGHT, DZ = SECTION_HEIGHT, DY = 1;
+
+    std::vector<uint16_t> stack;
+    for (size_t start = 0; start < ChunkSection::VOLUME; ++start) {
+        if (visited[start]) continue;
+
+        visited[start] = true;
+        stack.push_back(start);
+
+        uint8_t faces = 0;
+        while (!stack.empty()) {
+            int index = stack.back();
+            stack.pop_back();
+
+            int i = index / DX, j = (index / DZ) % SIZE, k = index % SECTION_HEIGHT;
+            std::array<std::pair<bool, int>, 6> neighbors = {{{i == SIZE - 1, index + DX},
+                                                              {i == 0, index - DX},
+                                                              {k == SECTION_HEIGHT - 1, index + DY},
+                                                              {k == 0, index - DY},
+                                                              {j == SIZE - 1, index + DZ},
+                                                              {j == 0, index - DZ}}};
+
+            for (int face = 0; face < 6; ++face) {
+                if (neighbors[face].first) {
+                    faces |= 1 << face;
+                } else if (!visited[neighbors[face].second]) {
+                    visited[neighbors[face].second] = true;
+                    stack.push_back(neighbors[face].second);
+                }
+            }
+        }
+
+        for (int face = 0; face < 6; ++face) {
+            if (faces & (1 << face)) connectivity[face] |= faces;
+        }
+
+        // Nothing more can be learned once every face is joined to every other
+        if (faces == ALL_FACES) break;
+    }
+}
+
+size_t Chunk::memoryUsage() const {
+    size_t result = sizeof(Chunk);
+    for (const ChunkSection& section : m_sections) result += section.memoryUsage();
+
+    return result;
+}
 
 bool Chunk::isTransparent(const Coordinate& location) const {
-    const Block* block = get(location);
-    return (block == nullptr || block->blockType == BlockLibrary::WATER);
+    int section;
+    size_t index;
+    if (!locate(location, section, index) || isSectionEmpty(section)) return true;
+    if (isSectionOpaque(section)) return false;
+
+    BlockId id = m_sections[section].get(index);
+    return (id == EMPTY || id == BlockLibrary::WATER + 1);
 }
 
 bool Chunk::isSolid(const Coordinate& location) const {
-    const Block* block = get(location);
-    return (block && block->blockType != BlockLibrary::WATER);
+    std::optional<BlockLibrary::Tag> block = get(location);
+    return (block && *block != BlockLibrary::WATER);
 }
 
-bool Chunk::openToSky(const Coordinate& location) const {
-    Coordinate current = location.addY(1);
-    while (current.y < DEPTH) {
-        if (!isTransparent(current)) return false;
+Chunk::Column Chunk::column(int x, int z) const {
+    Column result = {0, 0};
+
+    int i = x - m_x * SIZE;
+    int j = z - m_z * SIZE;
+    if (i < 0 || i >= SIZE || j < 0 || j >= SIZE) return result;
+
+    for (int s = 0; s < SECTIONS; ++s) {
+        if (isSectionEmpty(s)) continue;
+
+        int shift = s * SECTION_HEIGHT;
+        if (isSectionOpaque(s)) {
+            uint64_t bits = ((uint64_t(1) << SECTION_HEIGHT) - 1) << shift;
+            result.filled |= bits;
+            result.opaque |= bits;
+            continue;
+        }
+
+        const ChunkSection& section = m_sections[s];
+        for (int k = 0; k < SECTION_HEIGHT; ++k) {
+            BlockId id = section.get(ChunkSection::index(i, j, k));
+            if (id == EMPTY) continue;
 
-        ++current.y;
+            uint64_t bit = uint64_t(1) << (shift + k);
+            result.filled |= bit;
+            if (id != BlockLibrary::WATER + 1) result.opaque |= bit;
+        }
     }
 
-    return true;
-}
\ No newline at end of file
+    return result;
+}
+
+bool Chunk::openToSky(const Coordinate& location) const {
+    return location.y >= height(location.x, location.z);
+}
@@ -1,35 +1,71 @@
 #include <algorithm>
 #include <array>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
 #define GLM_FORCE_SWIZZLE
 #include <glm/glm.hpp>
-#include <glm/gtc/matrix_transform.hpp>
 
 #include "chunk_manager.hpp"
-#include "cube.hpp"
 #include "renderer.hpp"
 
-ChunkManager::ChunkManager(int seed) : m_seed(seed) {
-    // Create a bunch of vertex buffers initially, so that we don't
-    // have to keep allocating and deleting
-    m_vboPool.resize(MAX_OBJECTS);
-    glGenBuffers(MAX_OBJECTS, &m_vboPool[0]);
+ChunkManager::ChunkManager(int seed, const std::string& directory, ChunkStore::Format format,
+                           const Chunk::TerrainConfig& terrain)
+: m_seed(seed), m_terrain(terrain), m_replayEdits(true),
+  m_meshArena(sizeof(Vertex), MESH_BUFFER_VERTICES), m_defragmentSlot(0),
+  m_grid(GRID_SIZE * GRID_SIZE),
+  m_unloadQueue(ChunkQueue::FARTHEST_FIRST), m_cameraChunk(0, 0), m_predictedChunk(0, 0),
+  m_occlusionCulling(true), m_greedyMeshing(true), m_meshVersion(0) {
+    // The lattice's fields can be changed after it is constructed, so it is
+    // checked again before any chunk is generated with it
+    if (!terrain.lattice.valid()) {
+        throw std::invalid_argument("Noise lattice must divide the chunk");
+    }
+
+    if (directory.empty()) return;
+
+    ChunkStore::World world =
+        ChunkStore::loadWorld(directory, seed, Chunk::generatorId(terrain));
+    m_seed = world.seed;
+
+    // Edit logs replayed onto different terrain would leave the world a mess of
+    // stray blocks, so they are ignored, and chunks are saved whole from then on
+    if (!world.sameGenerator) {
+        std::cerr << "The world in " << directory << " was generated differently, so "
+                  << "chunks saved as edits will be regenerated without them" << std::endl;
+
+        m_replayEdits = false;
+        if (format == ChunkStore::EDITS) format = ChunkStore::UNCOMPRESSED;
+    }
+
+    m_store.reset(new ChunkStore(directory, format));
+}
+
+ChunkManager::~ChunkManager() {
+    for (Slot& s : m_grid) evictChunk(s);
 }
 
-void ChunkManager::freeMesh(const Chunk* chunk) {
-    auto i = m_meshes.find(chunk);
-    if (i != m_meshes.end()) {
-        // Return the vertex buffer to the pool to be reused
-        m_vboPool.push_back(i->second->vertexBuffer);
-        m_meshes.erase(i);
+void ChunkManager::freeMeshes(Slot& slot) {
+    if (slot.meshed) {
+        for (std::unique_ptr<Mesh>& mesh : slot.meshes) {
+            if (mesh) {
+                m_meshArena.free(mesh->vertices);
+                mesh.reset();
+            }
+        }
+
+        slot.meshed = false;
+        slot.dirtySections = 0;
     }
 }
 
 const Chunk* ChunkManager::getChunk(int x, int z) const {
-    auto i = m_chunks.find(std::make_pair(x, z));
-    if (i == m_chunks.end()) {
-        return nullptr;
+    const Slot& s = slot(x, z);
+    if (s.chunk && s.chunk->x() == x && s.chunk->z() == z) {
+        return &*s.chunk;
     } else {
-        return i->second.get();
+        return nullptr;
     }
 }
 
@@ -40,43 +76,103 @@ Chunk* ChunkManager::getChunk(int x, int z) {
 }
 
 const Chunk* ChunkManager::getChunk(const Coordinate& location) const {
-    int x = floor(location.x / float(Chunk::SIZE));
-    int z = floor(location.z / float(Chunk::SIZE));
-
-    return getChunk(x, z);
+    return getChunk(floorDiv(location.x, Chunk::SIZE), floorDiv(location.z, Chunk::SIZE));
 }
 
 Chunk* ChunkManager::getChunk(const Coordinate& location) {
     return const_cast<Chunk*>(static_cast<const ChunkManager&>(*this).getChunk(location));
 }
 
-Mesh* ChunkManager::getMesh(const Chunk* chunk) const {
-    auto i = m_meshes.find(chunk);
-    if (i == m_meshes.end()) {
-        return nullptr;
+const ChunkManager::ChunkMeshes* ChunkManager::getMeshes(const Chunk* chunk) const {
+    const Slot& s = slot(chunk->x(), chunk->z());
+    if (s.meshed) {
+        return &s.meshes;
     } else {
-        return i->second.get();
+        return nullptr;
     }
 }
 
-Mesh* ChunkManager::getOrCreateMesh(const Chunk* chunk) {
-    if (m_meshes.find(chunk) == m_meshes.end()) {
-        assert(!m_vboPool.empty());
+void ChunkManager::loadOrCreateChunk(int x, int z) {
+    std::pair<int, int> location(x, z);
+    if (m_pendingChunks.count(location) || m_pendingChunks.size() >= maxPending()) return;
 
-        std::unique_ptr<Mesh> mesh(new Mesh);
-        mesh->vertexBuffer = m_vboPool.back();
-        m_vboPool.pop_back();
+    m_pendingChunks.insert(location);
 
-        m_meshes[chunk] = std::move(mesh);
+    if (m_store) {
+        m_store->requestLoad(x, z);
+    } else {
+        generateChunk(x, z);
     }
+}
 
-    return m_meshes[chunk].get();
+void ChunkManager::generateChunk(int x, int z, std::optional<EditLog> edits) {
+    unsigned int seed = m_seed;
+    Chunk::TerrainConfig terrain = m_terrain;
+    CompletionQueue<GeneratedChunk>* finishedChunks = &m_finishedChunks;
+    m_jobSystem.submit([x, z, seed, terrain, finishedChunks, edits = std::move(edits)]() mutable {
+        Chunk chunk(x, z, seed, terrain);
+        if (edits) edits->apply(chunk);
+        finishedChunks->push(GeneratedChunk{std::move(chunk), std::move(edits)});
+    });
 }
 
-void ChunkManager::loadOrCreateChunk(int x, int z) {
-    // TODO: Load from a file
-    std::unique_ptr<Chunk> newChunk(new Chunk(x, z, m_seed));
-    m_chunks[std::make_pair(x, z)] = std::move(newChunk);
+void ChunkManager::collectFinishedChunks() {
+    // Chunks which were never saved stay pending until they have been generated
+    if (m_store) {
+        m_store->collectLoads([this](ChunkStore::LoadResult&& result) {
+            if (result.chunk) {
+                m_pendingChunks.erase(std::make_pair(result.x, result.z));
+                placeChunk(std::move(*result.chunk), false);
+            } else if (getChunk(result.x, result.z)) {
+                m_pendingChunks.erase(std::make_pair(result.x, result.z));
+            } else {
+                if (!m_replayEdits) result.edits.reset();
+                generateChunk(result.x, result.z, std::move(result.edits));
+            }
+        });
+    }
+
+    m_finishedChunks.drain([this](GeneratedChunk&& generated) {
+        m_pendingChunks.erase(std::make_pair(generated.chunk.x(), generated.chunk.z()));
+        placeGeneratedChunk(std::move(generated.chunk), std::move(generated.edits));
+    });
+}
+
+void ChunkManager::placeChunk(Chunk&& chunk, bool unsaved, std::optional<EditLog> edits) {
+    // The chunk may have been needed right away and loaded by loadNow
+    if (getChunk(chunk.x(), chunk.z())) return;
+
+    Slot& s = slot(chunk.x(), chunk.z());
+    evictChunk(s);
+    s.chunk.emplace(std::move(chunk));
+    s.unsaved = unsaved;
+    s.edits = std::move(edits);
+}
+
+// A generated chunk doesn't need saving at all if only edits are saved, and
+// otherwise has to be saved whole, even if it came from an edit log
+void ChunkManager::placeGeneratedChunk(Chunk&& chunk, std::optional<EditLog> edits) {
+    if (m_store && m_store->format() == ChunkStore::EDITS) {
+        placeChunk(std::move(chunk), false, edits ? std::move(edits) : EditLog());
+    } else {
+        placeChunk(std::move(chunk), true);
+    }
+}
+
+void ChunkManager::evictChunk(Slot& s) {
+    freeMeshes(s);
+
+    if (s.chunk && s.unsaved && m_store) {
+        if (s.edits) {
+            m_store->saveEdits(s.chunk->x(), s.chunk->z(), std::move(*s.edits));
+        } else {
+            m_store->save(std::move(*s.chunk));
+        }
+    }
+
+    s.chunk.reset();
+    s.unsaved = false;
+    s.edits.reset();
 }
 
 class DistanceToCamera {
@@ -88,43 +184,30 @@ public:
     }
 
     bool operator()(const std::pair<int, int>& lhs, const std::pair<int, int>& rhs) {
-        return glm::distance(chunkCenter(lhs), m_camera) <
-               glm::distance(chunkCenter(rhs), m_camera);
+        return distance2(chunkCenter(lhs)) < distance2(chunkCenter(rhs));
     }
 
 private:
+    float distance2(const glm::vec2& point) const {
+        glm::vec2 delta = point - m_camera;
+        return glm::dot(delta, delta);
+    }
+
     glm::vec2 m_camera;
 };
 
-std::vector<const Mesh*> ChunkManager::getVisibleMeshes(const Camera& camera) {
-    if (!m_chunkQueue.empty()) {
-        auto i =
-            std::min_element(m_chunkQueue.begin(), m_chunkQueue.end(), DistanceToCamera(camera));
+std::vector<const Mesh*> ChunkManager::getVisibleMeshes(const Camera& camera,
+                                                        const Frustum& frustum) {
+    collectFinishedChunks();
+    moveCamera(camera);
+    prefetch(camera);
 
-        // This chunk and all of its neighbors need to be loaded in order to determine
-        // the live faces and create the mesh
-        int x = i->first, z = i->second;
-        std::array<std::pair<int, int>, 5> chunkCoords = {
-            {{x, z}, {x + 1, z}, {x - 1, z}, {x, z + 1}, {x, z - 1}}};
+    // Edits are handled first, so that they show up as soon as possible
+    processRemeshQueue();
+    processChunkQueue();
 
-        bool loadedChunk = false;
-        for (std::pair<int, int>& chunkCoord : chunkCoords) {
-            Chunk* chunk = getChunk(chunkCoord.first, chunkCoord.second);
-            if (!chunk) {
-                loadOrCreateChunk(chunkCoord.first, chunkCoord.second);
-                loadedChunk = true;
-                break;
-            }
-        }
-
-        if (!loadedChunk) {
-            Chunk* chunk = getChunk(x, z);
-            Mesh* mesh = getOrCreateMesh(chunk);
-
-            rebuildMesh(chunk, mesh);
-            m_chunkQueue.erase(i);
-        }
-    }
+    uploadMeshes();
+    defragmentMeshes();
 
     std::vector<std::pair<int, int>> visibleChunks;
 
@@ -133,9 +216,8 @@ std::vector<const Mesh*> ChunkManager::getVisibleMeshes(const Camera& camera) {
     for (int i = -RENDER_RADIUS; i <= RENDER_RADIUS; ++i) {
         for (int j = -RENDER_RADIUS; j <= RENDER_RADIUS; ++j) {
             const Chunk* chunk = getChunk(x + i, z + j);
-            const Mesh* mesh = chunk ? getMesh(chunk) : nullptr;
-            if (!mesh) {
-                m_chunkQueue.insert(std::make_pair(x + i, z + j));
+            if (!chunk || !getMeshes(chunk)) {
+                m_chunkQueue.push(x + i, z + j);
                 continue;
             }
 
@@ -147,45 +229,332 @@ std::vector<const Mesh*> ChunkManager::getVisibleMeshes(const Camera& camera) {
     // transparency work correctly
     sort(visibleChunks.begin(), visibleChunks.end(), DistanceToCamera(camera));
 
+    std::vector<uint8_t> visibleSections = findVisibleSections(camera, frustum);
+
     std::vector<const Mesh*> meshes;
     for (std::pair<int, int>& chunkCoord : visibleChunks) {
-        const Mesh* mesh = getMesh(getChunk(chunkCoord.first, chunkCoord.second));
+        int i = chunkCoord.first - x, j = chunkCoord.second - z;
+        uint8_t sections = visibleSections[visibleIndex(i, j)];
+        if (!sections) continue;
+
+        const ChunkMeshes* chunkMeshes = getMeshes(getChunk(chunkCoord.first, chunkCoord.second));
+        for (int section = 0; section < Chunk::SECTIONS; ++section) {
+            const std::unique_ptr<Mesh>& mesh = (*chunkMeshes)[section];
+            if (mesh && (sections & (1 << section))) meshes.push_back(mesh.get());
+        }
+    }
+
+    processUnloadQueue();
 
-        meshes.push_back(mesh);
+    return meshes;
+}
+
+std::vector<uint8_t> ChunkManager::findVisibleSections(const Camera& camera,
+                                                       const Frustum& frustum) const {
+    const int WIDTH = 2 * RENDER_RADIUS + 1;
+    std::vector<uint8_t> visible(WIDTH * WIDTH, 0);
+
+    int cameraX = floor(camera.eye.x / (float)Chunk::SIZE);
+    int cameraZ = floor(camera.eye.z / (float)Chunk::SIZE);
+    int cameraSection = floor(camera.eye.y / (float)Chunk::SECTION_HEIGHT);
+
+    // A step into a section, relative to the camera's chunk. The entry face is
+    // the face of the new section that was crossed, and directions is the mask
+    // of faces that the search has left through so far.
+    struct Step {
+        int i, j, section;
+        int entry;
+        unsigned int directions;
+    };
+
+    // Offsets of the neighbor across each face, in the order +x, -x, +y, -y, +z, -z
+    static const std::array<std::array<int, 3>, 6> OFFSETS = {
+        {{{1, 0, 0}}, {{-1, 0, 0}}, {{0, 1, 0}}, {{0, -1, 0}}, {{0, 0, 1}}, {{0, 0, -1}}}};
+    const int ANY_FACE = 6;
+
+    // A section may be reached again through a different face, which can open
+    // up more of its neighbors, so the faces entered are tracked for each one
+    std::vector<uint8_t> entered(WIDTH * WIDTH * Chunk::SECTIONS, 0);
+    std::vector<Step> queue;
+
+    auto visit = [&](int i, int j, int section, int entry, unsigned int directions) {
+        if (std::abs(i) > RENDER_RADIUS || std::abs(j) > RENDER_RADIUS) return;
+        if (section < 0 || section >= Chunk::SECTIONS) return;
+
+        uint8_t& faces = entered[visibleIndex(i, j) * Chunk::SECTIONS + section];
+        uint8_t face = (entry == ANY_FACE) ? 0xff : 1 << entry;
+        if ((faces & face) == face) return;
+
+        glm::vec3 min((cameraX + i) * Chunk::SIZE, section * Chunk::SECTION_HEIGHT,
+                      (cameraZ + j) * Chunk::SIZE);
+        glm::vec3 max = min + glm::vec3(Chunk::SIZE, Chunk::SECTION_HEIGHT, Chunk::SIZE);
+        if (!frustum.intersects(min, max)) return;
+
+        faces |= face;
+        visible[visibleIndex(i, j)] |= 1 << section;
+        queue.push_back(Step{i, j, section, entry, directions});
+    };
+
+    // Without occlusion culling, every section in the frustum is visible
+    if (!m_occlusionCulling) {
+        for (int i = -RENDER_RADIUS; i <= RENDER_RADIUS; ++i) {
+            for (int j = -RENDER_RADIUS; j <= RENDER_RADIUS; ++j) {
+                for (int section = 0; section < Chunk::SECTIONS; ++section) {
+                    visit(i, j, section, ANY_FACE, 0);
+                }
+            }
+        }
+
+        return visible;
     }
 
-    // std::cout << "Loaded chunks: " << m_chunks.size() << ", loaded meshes = " << m_meshes.size()
-    // << std::endl; std::cout << "In queue: " << m_chunkQueue.size() << std::endl;
+    if (cameraSection >= Chunk::SECTIONS) {
+        // A camera above the world looks in through the tops of the chunks
+        for (int i = -RENDER_RADIUS; i <= RENDER_RADIUS; ++i) {
+            for (int j = -RENDER_RADIUS; j <= RENDER_RADIUS; ++j) {
+                visit(i, j, Chunk::SECTIONS - 1, 2, 1 << 3);
+            }
+        }
+    } else if (cameraSection < 0) {
+        for (int i = -RENDER_RADIUS; i <= RENDER_RADIUS; ++i) {
+            for (int j = -RENDER_RADIUS; j <= RENDER_RADIUS; ++j) visit(i, j, 0, 3, 1 << 2);
+        }
+    } else {
+        // The near plane is a little in front of the camera, so the camera's own
+        // section may be just outside of the frustum, but the search has to
+        // start from there regardless
+        entered[visibleIndex(0, 0) * Chunk::SECTIONS + cameraSection] = 0xff;
+        visible[visibleIndex(0, 0)] |= 1 << cameraSection;
+        queue.push_back(Step{0, 0, cameraSection, ANY_FACE, 0});
+    }
 
-    // Free/unload chunks and meshes that are far away from the camera
-    glm::vec2 camera2d = camera.eye.xz();
+    // Breadth-first, so that each section is usually first reached along the
+    // straightest path from the camera
+    for (size_t next = 0; next < queue.size(); ++next) {
+        Step step = queue[next];
+
+        // Chunks which haven't been loaded yet are treated as open
+        const Chunk* chunk = getChunk(cameraX + step.i, cameraZ + step.j);
+        for (int face = 0; face < 6; ++face) {
+            // Opposite faces differ only in the lowest bit
+            if (step.directions & (1 << (face ^ 1))) continue;
+            if (chunk && step.entry != ANY_FACE &&
+                !(chunk->connectedFaces(step.section, step.entry) & (1 << face))) {
+                continue;
+            }
 
-    // We have to do this loop manually because elements are being deleted inside the loop
-    auto j = m_chunks.begin();
-    while (j != m_chunks.end()) {
-        auto current = j++;
-        const std::pair<int, int>& location = current->first;
-        const Chunk* chunk = current->second.get();
+            const std::array<int, 3>& offset = OFFSETS[face];
+            visit(step.i + offset[0], step.j + offset[2], step.section + offset[1], face ^ 1,
+                  step.directions | (1 << face));
+        }
+    }
 
-        glm::vec2 chunkCenter = DistanceToCamera::chunkCenter(location);
-        if (glm::distance(chunkCenter, camera2d) > 5 * RENDER_RADIUS * Chunk::SIZE) {
-            freeMesh(chunk);
-            m_chunks.erase(current);
-        } else if (getMesh(chunk) &&
-                   glm::distance(chunkCenter, camera2d) > 2 * RENDER_RADIUS * Chunk::SIZE) {
-            freeMesh(chunk);
+    return visible;
+}
+
+// Maximum time to spend on each queue of chunk work in each frame
+const std::chrono::microseconds REMESH_BUDGET(1000);
+const std::chrono::microseconds CHUNK_BUDGET(1000);
+const std::chrono::microseconds UNLOAD_BUDGET(500);
+
+void ChunkManager::processRemeshQueue() {
+    auto start = std::chrono::steady_clock::now();
+    while (!m_remeshQueue.empty() && std::chrono::steady_clock::now() - start < REMESH_BUDGET) {
+        std::pair<int, int> location = m_remeshQueue.pop();
+
+        // The chunk may have been unloaded or lost its meshes since it was queued
+        Slot& s = slot(location.first, location.second);
+        const Chunk* chunk = getChunk(location.first, location.second);
+        if (!chunk || !s.meshed || !s.dirtySections) continue;
+
+        // All of a chunk's edited sections are meshed together, so that it only has
+        // to be copied once
+        std::vector<int> sections;
+        for (int section = 0; section < Chunk::SECTIONS; ++section) {
+            if (s.dirtySections & (1 << section)) sections.push_back(section);
         }
+
+        s.dirtySections = 0;
+        requestMeshes(chunk, sections);
     }
+}
 
-    return meshes;
+void ChunkManager::processChunkQueue() {
+    // Chunks which are still waiting on a neighbor go back in the queue afterwards
+    std::vector<std::pair<int, int>> waiting;
+
+    auto start = std::chrono::steady_clock::now();
+    while (!m_chunkQueue.empty() && std::chrono::steady_clock::now() - start < CHUNK_BUDGET) {
+        std::pair<int, int> location = m_chunkQueue.pop();
+        int x = location.first, z = location.second;
+
+        // Chunks which the camera has moved away from are dropped. They will be
+        // queued again if they come back into range.
+        if (!inRange(x, z)) continue;
+
+        const Chunk* chunk = getChunk(x, z);
+        if (chunk && getMeshes(chunk)) continue;
+
+        // This chunk and all of its neighbors need to be loaded in order to determine
+        // the live faces and create the mesh
+        std::array<std::pair<int, int>, 5> chunkCoords = {
+            {{x, z}, {x + 1, z}, {x - 1, z}, {x, z + 1}, {x, z - 1}}};
+
+        bool ready = true;
+        for (std::pair<int, int>& chunkCoord : chunkCoords) {
+            if (!getChunk(chunkCoord.first, chunkCoord.second)) {
+                loadOrCreateChunk(chunkCoord.first, chunkCoord.second);
+                ready = false;
+            }
+        }
+
+        if (ready) {
+            std::vector<int> allSections;
+            for (int section = 0; section < Chunk::SECTIONS; ++section) {
+                allSections.push_back(section);
+            }
+
+            requestMeshes(getChunk(x, z), allSections);
+        } else {
+            waiting.push_back(location);
+        }
+    }
+
+    for (std::pair<int, int>& location : waiting) {
+        m_chunkQueue.push(location.first, location.second);
+    }
+}
+
+void ChunkManager::moveCamera(const Camera& camera) {
+    int x = floor(camera.eye.x / (float)Chunk::SIZE);
+    int z = floor(camera.eye.z / (float)Chunk::SIZE);
+
+    std::pair<int, int> cameraChunk(x, z);
+    if (cameraChunk == m_cameraChunk) return;
+    m_cameraChunk = cameraChunk;
+
+    m_remeshQueue.setCenter(x, z);
+    m_unloadQueue.setCenter(x, z);
+
+    for (const Slot& s : m_grid) {
+        if (s.chunk && isDistant(s.chunk->x(), s.chunk->z(), 2 * RENDER_RADIUS)) {
+            m_unloadQueue.push(s.chunk->x(), s.chunk->z());
+        }
+    }
+}
+
+void ChunkManager::prefetch(const Camera& camera) {
+    // The prediction is limited to the render radius, so that prefetching never
+    // reaches much further than the chunks which are already meshed
+    glm::vec2 offset = PREFETCH_TIME * camera.velocity.xz();
+    float maxOffset = RENDER_RADIUS * Chunk::SIZE;
+    if (glm::length(offset) > maxOffset) offset *= maxOffset / glm::length(offset);
+
+    glm::vec2 predicted = camera.eye.xz() + offset;
+    int x = floor(predicted.x / Chunk::SIZE), z = floor(predicted.y / Chunk::SIZE);
+    m_predictedChunk = std::make_pair(x, z);
+
+    // Looking up or down shortens the lead, since less of the ground ahead is in view
+    glm::vec2 focus = predicted + float(Chunk::SIZE) * camera.gaze().xz();
+    m_chunkQueue.setCenter(floor(focus.x / Chunk::SIZE), floor(focus.y / Chunk::SIZE));
+
+    if (m_predictedChunk == m_cameraChunk) return;
+
+    for (int i = -RENDER_RADIUS; i <= RENDER_RADIUS; ++i) {
+        for (int j = -RENDER_RADIUS; j <= RENDER_RADIUS; ++j) {
+            const Chunk* chunk = getChunk(x + i, z + j);
+            if (!chunk || !getMeshes(chunk)) m_chunkQueue.push(x + i, z + j);
+        }
+    }
+}
+
+bool ChunkManager::inRange(int x, int z) const {
+    auto within = [x, z](const std::pair<int, int>& center) {
+        return std::abs(x - center.first) <= RENDER_RADIUS &&
+               std::abs(z - center.second) <= RENDER_RADIUS;
+    };
+
+    return within(m_cameraChunk) || within(m_predictedChunk);
+}
+
+void ChunkManager::loadNow(const glm::vec3& min, const glm::vec3& max) {
+    for (int x = floorDiv(floor(min.x), Chunk::SIZE); x <= floorDiv(floor(max.x), Chunk::SIZE);
+         ++x) {
+        for (int z = floorDiv(floor(min.z), Chunk::SIZE);
+             z <= floorDiv(floor(max.z), Chunk::SIZE); ++z) {
+            if (getChunk(x, z)) continue;
+
+            // If the chunk is already being loaded in the background, that copy
+            // is thrown away when it arrives
+            ChunkStore::LoadResult result{x, z, std::nullopt, std::nullopt};
+            if (m_store) result = m_store->load(x, z);
+
+            if (result.chunk) {
+                placeChunk(std::move(*result.chunk), false);
+            } else {
+                if (!m_replayEdits) result.edits.reset();
+
+                Chunk chunk(x, z, m_seed, m_terrain);
+                if (result.edits) result.edits->apply(chunk);
+                placeGeneratedChunk(std::move(chunk), std::move(result.edits));
+            }
+        }
+    }
+}
+
+bool ChunkManager::isDistant(int x, int z, int radius) const {
+    int dx = x - m_cameraChunk.first, dz = z - m_cameraChunk.second;
+    return dx * dx + dz * dz > radius * radius;
+}
+
+void ChunkManager::processUnloadQueue() {
+    auto start = std::chrono::steady_clock::now();
+    while (!m_unloadQueue.empty() && std::chrono::steady_clock::now() - start < UNLOAD_BUDGET) {
+        std::pair<int, int> location = m_unloadQueue.pop();
+        int x = location.first, z = location.second;
+
+        // The camera may have come back since the chunk was queued
+        Slot& s = slot(x, z);
+        if (!getChunk(x, z)) continue;
+
+        // The square around the predicted chunk reaches further than the radius
+        // at which meshes are freed, and is about to be drawn, so it keeps them
+        if (isDistant(x, z, CACHE_RADIUS)) {
+            evictChunk(s);
+        } else if (isDistant(x, z, 2 * RENDER_RADIUS) && !inRange(x, z)) {
+            freeMeshes(s);
+        }
+    }
 }
 
-const Block* ChunkManager::getBlock(const Coordinate& location) const {
+std::optional<BlockLibrary::Tag> ChunkManager::getBlock(const Coordinate& location) const {
     const Chunk* chunk = getChunk(location);
     if (chunk) {
         return chunk->get(location);
     } else {
-        return nullptr;
+        return std::nullopt;
+    }
+}
+
+void ChunkManager::markDirty(const Coordinate& location) {
+    // A change to a block can expose or hide faces of any of its neighbors, which
+    // may be in other sections or chunks
+    std::array<Coordinate, 7> affected = {{location, location.addX(1), location.addX(-1),
+                                           location.addY(1), location.addY(-1), location.addZ(1),
+                                           location.addZ(-1)}};
+
+    for (Coordinate& r : affected) {
+        if (r.y < 0 || r.y >= Chunk::DEPTH) continue;
+
+        // Chunks which haven't been meshed yet will see the edit when they are
+        const Chunk* chunk = getChunk(r);
+        if (!chunk) continue;
+
+        Slot& s = slot(chunk->x(), chunk->z());
+        if (s.meshed) {
+            s.dirtySections |= 1 << (r.y / Chunk::SECTION_HEIGHT);
+            m_remeshQueue.push(chunk->x(), chunk->z());
+        }
     }
 }
 
@@ -193,18 +562,12 @@ void ChunkManager::removeBlock(const Coordinate& location) {
     Chunk* chunk = getChunk(location);
     if (chunk) {
         chunk->removeBlock(location);
-        m_chunkQueue.insert(std::make_pair(chunk->x(), chunk->z()));
-    }
 
-    // If we remove a block adjacent to another chunk, its mesh also needs
-    // to be built again
-    std::array<Coordinate, 4> neighbors = {
-        {location.addX(1), location.addX(-1), location.addZ(1), location.addZ(-1)}};
+        Slot& s = slot(chunk->x(), chunk->z());
+        s.unsaved = true;
+        if (s.edits) s.edits->record(location, std::nullopt);
 
-    for (Coordinate& neighbor : neighbors) {
-        Chunk* otherChunk = getChunk(neighbor);
-        if (otherChunk && otherChunk != chunk)
-            m_chunkQueue.insert(std::make_pair(otherChunk->x(), otherChunk->z()));
+        markDirty(location);
     }
 }
 
@@ -212,7 +575,24 @@ void ChunkManager::createBlock(const Coordinate& location, BlockLibrary::Tag tag
     Chunk* chunk = getChunk(location);
     if (chunk) {
         chunk->newBlock(location.x, location.y, location.z, tag);
-        m_chunkQueue.insert(std::make_pair(chunk->x(), chunk->z()));
+
+        Slot& s = slot(chunk->x(), chunk->z());
+        s.unsaved = true;
+        if (s.edits) s.edits->record(location, tag);
+
+        markDirty(location);
+    }
+}
+
+void ChunkManager::setGreedyMeshing(bool greedy) {
+    if (greedy == m_greedyMeshing) return;
+    m_greedyMeshing = greedy;
+
+    for (Slot& s : m_grid) {
+        if (!s.chunk || !s.meshed) continue;
+
+        s.dirtySections = (1 << Chunk::SECTIONS) - 1;
+        m_remeshQueue.push(s.chunk->x(), s.chunk->z());
     }
 }
 
@@ -227,110 +607,109 @@ bool ChunkManager::isSolid(const Coordinate& location) const {
 }
 
 bool ChunkManager::isEmpty(const Coordinate& location) const {
-    const Block* block = getBlock(location);
-    return (block == nullptr);
-}
-
-unsigned int ChunkManager::getLiveFaces(const Coordinate& r) const {
-    // TODO: Precompute a lot of this
-    unsigned int mask = 0;
-    if (isTransparent(r) && !isEmpty(r)) {
-        if (isEmpty(r.addX(1))) mask |= PLUS_X;
-        if (isEmpty(r.addX(-1))) mask |= MINUS_X;
-        if (isEmpty(r.addY(1))) mask |= PLUS_Y;
-        if (isEmpty(r.addY(-1))) mask |= MINUS_Y;
-        if (isEmpty(r.addZ(1))) mask |= PLUS_Z;
-        if (isEmpty(r.addZ(-1))) mask |= MINUS_Z;
-    } else {
-        if (isTransparent(r.addX(1))) mask |= PLUS_X;
-        if (isTransparent(r.addX(-1))) mask |= MINUS_X;
-        if (isTransparent(r.addY(1))) mask |= PLUS_Y;
-        if (isTransparent(r.addY(-1))) mask |= MINUS_Y;
-        if (isTransparent(r.addZ(1))) mask |= PLUS_Z;
-        if (isTransparent(r.addZ(-1))) mask |= MINUS_Z;
-    }
-
-    return mask;
+    return !getBlock(location);
 }
 
-void ChunkManager::rebuildMesh(const Chunk* chunk, Mesh* mesh) {
-    std::vector<Vertex> vertices;
-
-    unsigned int masks[6] = {PLUS_X, MINUS_X, PLUS_Y, MINUS_Y, PLUS_Z, MINUS_Z};
+void ChunkManager::requestMeshes(const Chunk* chunk, const std::vector<int>& sections) {
+    int x = chunk->x(), z = chunk->z();
+    std::array<const Chunk*, 4> neighbors = {
+        {getChunk(x + 1, z), getChunk(x - 1, z), getChunk(x, z + 1), getChunk(x, z - 1)}};
 
-    // Determine lighting for each face
-    float lighting[6];
-    for (size_t face = 0; face < 6; ++face) {
-        glm::vec3 normal = glm::normalize(cubeMesh[face * 6].normal);
-        glm::vec3 sun = glm::normalize(glm::vec3(-4.0, 2.0, 1.0));
+    Slot& s = slot(x, z);
+    s.meshed = true;
 
-        float diffuse = glm::clamp(std::abs(0.7 * glm::dot(normal, sun)), 0.0, 1.0);
-        float ambient = 0.3;
-        lighting[face] = glm::clamp(diffuse + ambient, 0.0f, 1.0f);
+    std::vector<uint64_t> versions;
+    for (int section : sections) {
+        s.meshVersions[section] = ++m_meshVersion;
+        versions.push_back(m_meshVersion);
     }
 
-    // First pass is for opaque blocks
-    mesh->opaqueVertices = 0;
-    for (auto& itr : chunk->blocks()) {
-        const std::unique_ptr<Block>& block = itr.second;
-        if (block->blockType == BlockLibrary::WATER) continue;
+    ChunkMesher mesher(*chunk, neighbors, m_greedyMeshing);
+    CompletionQueue<MeshResult>* finishedMeshes = &m_finishedMeshes;
+    m_jobSystem.submit([mesher = std::move(mesher), x, z, sections, versions, finishedMeshes] {
+        std::vector<ChunkMesher::SectionMesh> meshes = mesher.build(sections);
+        for (size_t i = 0; i < sections.size(); ++i) {
+            finishedMeshes->push(MeshResult{x, z, sections[i], versions[i], std::move(meshes[i])});
+        }
+    });
+}
 
-        // Translate the cube mesh to the appropriate place in world coordinates
-        glm::mat4 model = glm::translate(glm::mat4(1.0f), block->location.vec3());
+// Maximum time to spend uploading meshes in each frame
+const std::chrono::microseconds UPLOAD_BUDGET(2000);
 
-        unsigned int liveFaces = getLiveFaces(block->location);
-        for (size_t face = 0; face < 6; ++face) {
-            if (liveFaces & masks[face]) {
-                for (size_t i = 0; i < 6; ++i) {
-                    CubeVertex cubeVertex = cubeMesh[face * 6 + i];
+void ChunkManager::uploadMeshes() {
+    m_finishedMeshes.drain(
+        [this](MeshResult&& result) { m_uploadQueue.push_back(std::move(result)); });
 
-                    Vertex vertex;
-                    copyVector(vertex.position,
-                               glm::vec3(model * glm::vec4(cubeVertex.position, 1.0)));
-                    copyVector(vertex.texCoord,
-                               glm::vec3(cubeVertex.texCoord, block->blockType * 6 + face));
-                    vertex.lighting = lighting[face];
+    auto start = std::chrono::steady_clock::now();
+    while (!m_uploadQueue.empty() && std::chrono::steady_clock::now() - start < UPLOAD_BUDGET) {
+        const MeshResult& result = m_uploadQueue.front();
 
-                    vertices.push_back(vertex);
-                    ++mesh->opaqueVertices;
-                }
-            }
+        // Meshes for chunks which have since been unloaded, or sections which have
+        // since been edited again, are thrown away
+        Slot& s = slot(result.x, result.z);
+        if (getChunk(result.x, result.z) && s.meshed &&
+            s.meshVersions[result.section] == result.version) {
+            uploadMesh(s.meshes[result.section], result);
         }
+
+        m_uploadQueue.pop_front();
     }
+}
 
-    // Second pass is for transparent blocks
-    mesh->transparentVertices = 0;
-    for (auto& itr : chunk->blocks()) {
-        const std::unique_ptr<Block>& block = itr.second;
-        if (block->blockType != BlockLibrary::WATER) continue;
+void ChunkManager::uploadMesh(std::unique_ptr<Mesh>& mesh, const MeshResult& result) {
+    const ChunkMesher::SectionMesh& sectionMesh = result.mesh;
+    const std::vector<Vertex>& vertices = sectionMesh.vertices;
 
-        // Translate the cube mesh to the appropriate place in world coordinates
-        glm::mat4 model = glm::translate(glm::mat4(1.0f), block->location.vec3());
+    // Sections without any visible faces don't hold on to any vertex memory
+    if (vertices.empty()) {
+        if (mesh) {
+            m_meshArena.free(mesh->vertices);
+            mesh.reset();
+        }
 
-        unsigned int liveFaces = getLiveFaces(block->location);
-        for (size_t face = 0; face < 6; ++face) {
-            if (liveFaces & masks[face]) {
-                for (size_t i = 0; i < 6; ++i) {
-                    CubeVertex cubeVertex = cubeMesh[face * 6 + i];
+        return;
+    }
 
-                    Vertex vertex;
-                    copyVector(vertex.position,
-                               glm::vec3(model * glm::vec4(cubeVertex.position, 1.0)));
-                    copyVector(vertex.texCoord,
-                               glm::vec3(cubeVertex.texCoord, block->blockType * 6 + face));
-                    vertex.lighting = lighting[face];
+    if (!mesh) mesh.reset(new Mesh);
 
-                    vertices.push_back(vertex);
-                    ++mesh->transparentVertices;
-                }
-            }
-        }
-    }
+    mesh->opaqueVertices = sectionMesh.opaqueVertices;
+    mesh->transparentVertices = sectionMesh.transparentVertices;
 
-    glBindBuffer(GL_ARRAY_BUFFER, mesh->vertexBuffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertices.size(), &vertices[0], GL_STATIC_DRAW);
+    // The existing range is reused if the new mesh fits in it
+    m_meshArena.reallocate(mesh->vertices, vertices.size());
+    m_meshArena.upload(mesh->vertices, &vertices[0], vertices.size());
 
     // std::cout << "Vertex count: " << vertices.size() << std::endl;
     // std::cout << "VBO size: " << (sizeof(Vertex) * vertices.size() / (1 << 20)) << "MB" <<
     // std::endl;
 }
+
+// Maximum time to spend moving meshes out of a fragmented buffer in each frame
+const std::chrono::microseconds DEFRAGMENT_BUDGET(500);
+
+void ChunkManager::defragmentMeshes() {
+    if (m_defragmentFailed == m_meshArena.generation()) return;
+    m_defragmentFailed.reset();
+
+    GLuint buffer = m_meshArena.fragmentedBuffer();
+    if (!buffer) return;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t n = 0; n < m_grid.size(); ++n) {
+        if (std::chrono::steady_clock::now() - start >= DEFRAGMENT_BUDGET) return;
+
+        Slot& s = m_grid[m_defragmentSlot];
+        if (s.meshed) {
+            for (std::unique_ptr<Mesh>& mesh : s.meshes) {
+                if (mesh && mesh->vertices.buffer == buffer &&
+                    !m_meshArena.relocate(mesh->vertices)) {
+                    m_defragmentFailed = m_meshArena.generation();
+                    return;
+                }
+            }
+        }
+
+        m_defragmentSlot = (m_defragmentSlot + 1) % m_grid.size();
+    }
+}
@@ -0,0 +1,315 @@
+#include "chunk_mesher.hpp"
+
+#include <cassert>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#include "cube.hpp"
+
+ChunkMesher::ChunkMesher(const Chunk& chunk, const std::array<const Chunk*, 4>& neighbors,
+                         bool greedy)
+: m_chunk(chunk), m_greedy(greedy) {
+    for (const Chunk* neighbor : neighbors) m_neighbors.push_back(*neighbor);
+}
+
+const Chunk* ChunkMesher::getChunk(const Coordinate& location) const {
+    int x = m_chunk.x() * Chunk::SIZE, z = m_chunk.z() * Chunk::SIZE;
+    if (location.x >= x && location.x < x + Chunk::SIZE && location.z >= z &&
+        location.z < z + Chunk::SIZE) {
+        return &m_chunk;
+    }
+
+    for (const Chunk& neighbor : m_neighbors) {
+        x = neighbor.x() * Chunk::SIZE, z = neighbor.z() * Chunk::SIZE;
+        if (location.x >= x && location.x < x + Chunk::SIZE && location.z >= z &&
+            location.z < z + Chunk::SIZE) {
+            return &neighbor;
+        }
+    }
+
+    return nullptr;
+}
+
+void ChunkMesher::findLiveFaces(LiveFaces& liveFaces) const {
+    const int SIZE = Chunk::SIZE;
+    int minX = m_chunk.x() * SIZE, minZ = m_chunk.z() * SIZE;
+
+    // Occupancy of the chunk's columns, padded on each side with the border
+    // columns of the neighboring chunk. The corners are never needed.
+    Chunk::Column columns[SIZE + 2][SIZE + 2] = {};
+    for (int i = -1; i <= SIZE; ++i) {
+        for (int j = -1; j <= SIZE; ++j) {
+            if ((i < 0 || i == SIZE) && (j < 0 || j == SIZE)) continue;
+
+            const Chunk* chunk = getChunk(Coordinate(minX + i, 0, minZ + j));
+            if (chunk) columns[i + 1][j + 1] = chunk->column(minX + i, minZ + j);
+        }
+    }
+
+    // Opaque blocks show the faces which are next to a transparent block (or
+    // nothing), and transparent blocks only show the faces next to nothing
+    auto live = [](const Chunk::Column& column, const Chunk::Column& neighbor) {
+        uint64_t transparent = column.filled & ~column.opaque;
+        return (column.opaque & ~neighbor.opaque) | (transparent & ~neighbor.filled);
+    };
+
+    for (int i = 0; i < SIZE; ++i) {
+        for (int j = 0; j < SIZE; ++j) {
+            const Chunk::Column& column = columns[i + 1][j + 1];
+
+            // Shifting the column by one block gives the neighbors above and
+            // below, and leaves the faces at the top and bottom of the world live
+            Chunk::Column above = {column.filled >> 1, column.opaque >> 1};
+            Chunk::Column below = {column.filled << 1, column.opaque << 1};
+
+            std::array<uint64_t, 6>& faces = liveFaces[i * SIZE + j];
+            faces[0] = live(column, columns[i + 2][j + 1]);
+            faces[1] = live(column, columns[i][j + 1]);
+            faces[2] = live(column, above);
+            faces[3] = live(column, below);
+            faces[4] = live(column, columns[i + 1][j + 2]);
+            faces[5] = live(column, columns[i + 1][j]);
+        }
+    }
+}
+
+unsigned int ChunkMesher::getLiveFaces(const LiveFaces& liveFaces, const Coordinate& r) const {
+    int i = r.x - m_chunk.x() * Chunk::SIZE, j = r.z - m_chunk.z() * Chunk::SIZE;
+    const std::array<uint64_t, 6>& faces = liveFaces[i * Chunk::SIZE + j];
+
+    unsigned int mask = 0;
+    for (size_t face = 0; face < 6; ++face) mask |= ((faces[face] >> r.y) & 1) << face;
+
+    return mask;
+}
+
+bool ChunkMesher::isBuried(int section) const {
+    if (!m_chunk.isSectionOpaque(section)) return false;
+
+    // Faces on the top and bottom of the world are always drawn
+    if (section == 0 || section == Chunk::SECTIONS - 1) return false;
+    if (!m_chunk.isSectionOpaque(section + 1) || !m_chunk.isSectionOpaque(section - 1)) {
+        return false;
+    }
+
+    for (const Chunk& neighbor : m_neighbors) {
+        if (!neighbor.isSectionOpaque(section)) return false;
+    }
+
+    return true;
+}
+
+namespace {
+
+// The two triangles of each face of the cube mesh share an edge, so each face
+// can be drawn from four corners. Corners (0, 1, 2) and (3, 2, 1) give the
+// triangles of the face, with the same winding as the cube mesh.
+std::array<glm::ivec3, 4> quadCorners(size_t face) {
+    const CubeVertex* vertices = &cubeMesh[face * 6];
+    auto index = [&](const glm::vec3& position, int triangle) {
+        for (int i = 0; i < 3; ++i) {
+            if (vertices[triangle * 3 + i].position == position) return i;
+        }
+        return -1;
+    };
+
+    // The corner of the second triangle which isn't in the first one comes last,
+    // followed by the shared edge in the order that it appears in the second one
+    int last = 0;
+    while (index(vertices[3 + last].position, 0) >= 0) ++last;
+
+    std::array<glm::ivec3, 4> corners;
+    corners[3] = glm::ivec3(vertices[3 + last].position);
+    corners[2] = glm::ivec3(vertices[3 + (last + 1) % 3].position);
+    corners[1] = glm::ivec3(vertices[3 + (last + 2) % 3].position);
+
+    int second = index(vertices[3 + (last + 2) % 3].position, 0);
+    corners[0] = glm::ivec3(vertices[(second + 2) % 3].position);
+    assert(glm::ivec3(vertices[(second + 1) % 3].position) == corners[2]);
+
+    return corners;
+}
+
+// Emit the four corners of a face of the cube with its minimum corner at
+// origin (relative to the chunk), stretched by extent blocks along each axis
+void emitQuad(std::vector<Vertex>& vertices, const Chunk& chunk, size_t face,
+              const glm::ivec3& origin, const glm::ivec3& extent, int layer) {
+    static const std::array<glm::ivec3, 4> corners[6] = {quadCorners(0), quadCorners(1),
+                                                         quadCorners(2), quadCorners(3),
+                                                         quadCorners(4), quadCorners(5)};
+
+    for (const glm::ivec3& corner : corners[face]) {
+        vertices.push_back(packVertex(chunk.x(), chunk.z(), origin + corner * extent, face, layer));
+    }
+}
+
+}  // namespace
+
+std::vector<ChunkMesher::SectionMesh> ChunkMesher::build(const std::vector<int>& sections) const {
+    LiveFaces liveFaces;
+    findLiveFaces(liveFaces);
+
+    std::vector<SectionMesh> results(sections.size());
+    for (size_t i = 0; i < sections.size(); ++i) {
+        SectionMesh& result = results[i];
+        result.opaqueVertices = result.transparentVertices = 0;
+        if (isBuried(sections[i])) continue;
+
+        if (m_greedy) {
+            buildGreedy(liveFaces, sections[i], result);
+        } else {
+            buildSimple(liveFaces, sections[i], result);
+        }
+    }
+
+    return results;
+}
+
+void ChunkMesher::buildSimple(const LiveFaces& liveFaces, int section,
+                              SectionMesh& result) const {
+    std::vector<Vertex>& vertices = result.vertices;
+
+    // Only the blocks on the boundary of an opaque section can have any live faces
+    bool opaque = m_chunk.isSectionOpaque(section);
+    int minY = section * Chunk::SECTION_HEIGHT, maxY = minY + Chunk::SECTION_HEIGHT - 1;
+    int minX = m_chunk.x() * Chunk::SIZE, maxX = minX + Chunk::SIZE - 1;
+    int minZ = m_chunk.z() * Chunk::SIZE, maxZ = minZ + Chunk::SIZE - 1;
+    auto isInterior = [&](const Coordinate& r) {
+        return r.x > minX && r.x < maxX && r.y > minY && r.y < maxY && r.z > minZ && r.z < maxZ;
+    };
+
+    // First pass is for opaque blocks
+    m_chunk.forEachBlock(section, [&](const Block& block) {
+        if (block.blockType == BlockLibrary::WATER) return;
+        if (opaque && isInterior(block.location)) return;
+
+        const Coordinate& r = block.location;
+        glm::ivec3 local(r.x - minX, r.y, r.z - minZ);
+
+        unsigned int faces = getLiveFaces(liveFaces, r);
+        for (size_t face = 0; face < 6; ++face) {
+            if (faces & (1 << face)) {
+                emitQuad(vertices, m_chunk, face, local, glm::ivec3(1),
+                         block.blockType * 6 + face);
+                result.opaqueVertices += 4;
+            }
+        }
+    });
+
+    // Second pass is for transparent blocks
+    m_chunk.forEachBlock(section, [&](const Block& block) {
+        if (block.blockType != BlockLibrary::WATER) return;
+
+        const Coordinate& r = block.location;
+        glm::ivec3 local(r.x - minX, r.y, r.z - minZ);
+
+        unsigned int faces = getLiveFaces(liveFaces, r);
+        for (size_t face = 0; face < 6; ++face) {
+            if (faces & (1 << face)) {
+                emitQuad(vertices, m_chunk, face, local, glm::ivec3(1),
+                         block.blockType * 6 + face);
+                result.transparentVertices += 4;
+            }
+        }
+    });
+}
+
+void ChunkMesher::buildGreedy(const LiveFaces& liveFaces, int section,
+                              SectionMesh& result) const {
+    const int SIZE = Chunk::SIZE, HEIGHT = Chunk::SECTION_HEIGHT;
+    static_assert(Chunk::SIZE == Chunk::SECTION_HEIGHT, "sections must be cubes");
+
+    // Gather the type of every block in the section, indexed by local (x, y, z).
+    // A type of zero means that there is no block there.
+    auto localIndex = [](const int local[3]) {
+        return (local[0] * HEIGHT + local[1]) * SIZE + local[2];
+    };
+
+    std::vector<uint8_t> types(SIZE * HEIGHT * SIZE, 0);
+
+    int minY = section * HEIGHT;
+    int minX = m_chunk.x() * SIZE, minZ = m_chunk.z() * SIZE;
+    m_chunk.forEachBlock(section, [&](const Block& block) {
+        int local[3] = {block.location.x - minX, block.location.y - minY,
+                        block.location.z - minZ};
+        types[localIndex(local)] = block.blockType + 1;
+    });
+
+    // Opaque faces come first, followed by water
+    for (int pass = 0; pass < 2; ++pass) {
+        bool transparent = (pass == 1);
+
+        for (size_t face = 0; face < 6; ++face) {
+            int n = face / 2, a = (n + 1) % 3, b = (n + 2) % 3;
+
+            for (int slice = 0; slice < SIZE; ++slice) {
+                // Type of each live face in this plane, indexed by [i][j], where
+                // i runs along axis a and j runs along axis b
+                uint8_t plane[SIZE][SIZE];
+                for (int i = 0; i < SIZE; ++i) {
+                    for (int j = 0; j < SIZE; ++j) {
+                        int local[3];
+                        local[n] = slice, local[a] = i, local[b] = j;
+
+                        uint8_t type = types[localIndex(local)];
+                        uint64_t faces = liveFaces[local[0] * SIZE + local[2]][face];
+                        bool isWater = (type == BlockLibrary::WATER + 1);
+                        bool live = ((faces >> (minY + local[1])) & 1) && isWater == transparent;
+                        plane[i][j] = live ? type : 0;
+                    }
+                }
+
+                // Grow each rectangle first along a and then along b
+                for (int j = 0; j < SIZE; ++j) {
+                    for (int i = 0; i < SIZE;) {
+                        uint8_t type = plane[i][j];
+                        if (!type) {
+                            ++i;
+                            continue;
+                        }
+
+                        int width = 1;
+                        while (i + width < SIZE && plane[i + width][j] == type) ++width;
+
+                        int height = 1;
+                        while (j + height < SIZE) {
+                            bool rowMatches = true;
+                            for (int k = i; k < i + width; ++k) {
+                                if (plane[k][j + height] != type) {
+                                    rowMatches = false;
+                                    break;
+                                }
+                            }
+
+                            if (!rowMatches) break;
+                            ++height;
+                        }
+
+                        for (int l = j; l < j + height; ++l) {
+                            for (int k = i; k < i + width; ++k) plane[k][l] = 0;
+                        }
+
+                        glm::ivec3 origin(0, minY, 0);
+                        origin[n] += slice;
+                        origin[a] += i;
+                        origin[b] += j;
+
+                        glm::ivec3 extent(1);
+                        extent[a] = width;
+                        extent[b] = height;
+
+                        BlockLibrary::Tag tag = type - 1;
+                        emitQuad(result.vertices, m_chunk, face, origin, extent, tag * 6 + face);
+                        if (transparent) {
+                            result.transparentVertices += 4;
+                        } else {
+                            result.opaqueVertices += 4;
+                        }
+
+                        i += width;
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,47 @@
+#include "chunk_queue.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+ChunkQueue::ChunkQueue(Order order)
+: m_order(order), m_centerX(0), m_centerZ(0), m_stale(false) {}
+
+int ChunkQueue::priority(int x, int z) const {
+    int dx = x - m_centerX, dz = z - m_centerZ;
+    int distance2 = dx * dx + dz * dz;
+    return m_order == NEAREST_FIRST ? -distance2 : distance2;
+}
+
+void ChunkQueue::push(int x, int z) {
+    if (!m_members.insert(std::make_pair(x, z)).second) return;
+
+    m_heap.push_back(Entry{priority(x, z), x, z});
+
+    // A stale heap is rebuilt from scratch before the next pop anyway
+    if (!m_stale) std::push_heap(m_heap.begin(), m_heap.end());
+}
+
+std::pair<int, int> ChunkQueue::pop() {
+    assert(!m_heap.empty());
+
+    if (m_stale) {
+        for (Entry& entry : m_heap) entry.priority = priority(entry.x, entry.z);
+        std::make_heap(m_heap.begin(), m_heap.end());
+        m_stale = false;
+    }
+
+    std::pop_heap(m_heap.begin(), m_heap.end());
+    std::pair<int, int> location(m_heap.back().x, m_heap.back().z);
+    m_heap.pop_back();
+    m_members.erase(location);
+
+    return location;
+}
+
+void ChunkQueue::setCenter(int x, int z) {
+    if (x == m_centerX && z == m_centerZ) return;
+
+    m_centerX = x;
+    m_centerZ = z;
+    m_stale = true;
+}
@@ -0,0 +1,182 @@
+#include "chunk_section.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+
+// The narrowest supported width which can address a palette of the given size
+static size_t bitsForPalette(size_t paletteSize) {
+    if (paletteSize <= 1) return 0;
+    if (paletteSize <= 2) return 1;
+    if (paletteSize <= 4) return 2;
+    if (paletteSize <= 16) return 4;
+
+    assert(paletteSize <= 256);
+    return 8;
+}
+
+ChunkSection::ChunkSection() : m_palette(1, EMPTY), m_bits(0), m_words(nullptr) {}
+
+ChunkSection::ChunkSection(const ChunkSection& other)
+: m_palette(other.m_palette), m_bits(other.m_bits), m_cells(other.m_cells),
+  m_mapping(other.m_mapping), m_words(m_mapping ? other.m_words : m_cells.data()) {}
+
+ChunkSection& ChunkSection::operator=(const ChunkSection& other) {
+    if (this != &other) *this = ChunkSection(other);
+    return *this;
+}
+
+void ChunkSection::unmap() {
+    if (!m_mapping) return;
+
+    m_cells.assign(m_words, m_words + VOLUME * m_bits / 64);
+    m_words = m_cells.data();
+    m_mapping.reset();
+}
+
+size_t ChunkSection::paletteIndex(size_t index) const {
+    if (m_bits == 0) return 0;
+
+    size_t position = index * m_bits;
+    uint64_t mask = (uint64_t(1) << m_bits) - 1;
+    return (m_words[position / 64] >> (position % 64)) & mask;
+}
+
+void ChunkSection::setPaletteIndex(size_t index, size_t value) {
+    size_t position = index * m_bits;
+    uint64_t mask = (uint64_t(1) << m_bits) - 1;
+
+    uint64_t& word = m_cells[position / 64];
+    word &= ~(mask << (position % 64));
+    word |= uint64_t(value) << (position % 64);
+}
+
+ChunkSection::BlockId ChunkSection::get(size_t index) const {
+    return m_palette[paletteIndex(index)];
+}
+
+void ChunkSection::set(size_t index, BlockId value) {
+    auto i = std::find(m_palette.begin(), m_palette.end(), value);
+    size_t entry = i - m_palette.begin();
+
+    if (i == m_palette.end()) {
+        m_palette.push_back(value);
+        if (m_palette.size() > (size_t(1) << m_bits)) resize(bitsForPalette(m_palette.size()));
+    }
+
+    if (m_bits > 0) {
+        unmap();
+        setPaletteIndex(index, entry);
+    }
+}
+
+bool ChunkSection::contains(BlockId value) const {
+    return std::find(m_palette.begin(), m_palette.end(), value) != m_palette.end();
+}
+
+void ChunkSection::resize(size_t bits) {
+    assert(m_palette.size() <= (size_t(1) << bits));
+
+    std::array<uint8_t, VOLUME> indices;
+    for (size_t i = 0; i < VOLUME; ++i) indices[i] = paletteIndex(i);
+
+    m_bits = bits;
+    m_cells.assign(VOLUME * bits / 64, 0);
+    m_words = m_cells.data();
+    m_mapping.reset();
+    if (bits == 0) return;
+
+    for (size_t i = 0; i < VOLUME; ++i) setPaletteIndex(i, indices[i]);
+}
+
+void ChunkSection::assign(const BlockId* cells) {
+    // Palette entries are assigned in order of first appearance
+    std::array<int, 256> entries;
+    entries.fill(-1);
+
+    m_palette.clear();
+    for (size_t i = 0; i < VOLUME; ++i) {
+        if (entries[cells[i]] < 0) {
+            entries[cells[i]] = m_palette.size();
+            m_palette.push_back(cells[i]);
+        }
+    }
+
+    m_palette.shrink_to_fit();
+    m_bits = bitsForPalette(m_palette.size());
+
+    std::vector<uint64_t>(VOLUME * m_bits / 64, 0).swap(m_cells);
+    m_words = m_cells.data();
+    m_mapping.reset();
+    if (m_bits == 0) return;
+
+    for (size_t i = 0; i < VOLUME; ++i) setPaletteIndex(i, entries[cells[i]]);
+}
+
+void ChunkSection::compact() {
+    std::array<BlockId, VOLUME> cells;
+    for (size_t i = 0; i < VOLUME; ++i) cells[i] = get(i);
+
+    assign(&cells[0]);
+}
+
+size_t ChunkSection::memoryUsage() const {
+    return m_palette.capacity() * sizeof(BlockId) + m_cells.capacity() * sizeof(uint64_t);
+}
+
+void ChunkSection::write(std::vector<uint8_t>& out) const {
+    putInteger<uint8_t>(out, m_bits);
+    putInteger<uint16_t>(out, m_palette.size());
+    out.insert(out.end(), m_palette.begin(), m_palette.end());
+
+    putPadding(out, sizeof(uint64_t));
+    for (size_t i = 0; i < VOLUME * m_bits / 64; ++i) putInteger(out, m_words[i]);
+}
+
+bool ChunkSection::read(ByteReader& reader, BlockId maxId, std::shared_ptr<const void> mapping) {
+    size_t bits = reader.getInteger<uint8_t>();
+    size_t paletteSize = reader.getInteger<uint16_t>();
+    if (bits != 0 && bits != 1 && bits != 2 && bits != 4 && bits != 8) return false;
+    if (paletteSize == 0 || paletteSize > (size_t(1) << bits)) return false;
+
+    const uint8_t* palette = reader.getBytes(paletteSize);
+    if (!palette) return false;
+    for (size_t i = 0; i < paletteSize; ++i) {
+        if (palette[i] > maxId) return false;
+    }
+
+    reader.align(sizeof(uint64_t));
+    size_t words = VOLUME * bits / 64;
+    const uint8_t* cells = reader.getBytes(words * sizeof(uint64_t));
+    if (!cells) return false;
+
+    ChunkSection section;
+    section.m_palette.assign(palette, palette + paletteSize);
+    section.m_bits = bits;
+
+    // The saved words can only be used in place if they are laid out just as
+    // they would be in memory
+    bool inPlace = mapping && words > 0 &&
+                   reinterpret_cast<uintptr_t>(cells) % alignof(uint64_t) == 0;
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+    inPlace = false;
+#endif
+
+    if (inPlace) {
+        section.m_mapping = std::move(mapping);
+        section.m_words = reinterpret_cast<const uint64_t*>(cells);
+    } else {
+        ByteReader cellReader(cells, words * sizeof(uint64_t));
+        section.m_cells.resize(words);
+        for (uint64_t& word : section.m_cells) word = cellReader.getInteger<uint64_t>();
+        section.m_words = section.m_cells.data();
+    }
+
+    // Every cell has to refer to an entry of the palette
+    for (size_t i = 0; i < VOLUME; ++i) {
+        if (section.paletteIndex(i) >= paletteSize) return false;
+    }
+
+    *this = std::move(section);
+    return true;
+}
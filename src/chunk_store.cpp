@@ -0,0 +1,213 @@
+#include "chunk_store.hpp"
+
+#include <zlib.h>
+
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <sstream>
+
+#include "byte_stream.hpp"
+#include "coordinate.hpp"
+
+ChunkStore::ChunkStore(const std::string& directory, Format format)
+: m_directory(directory), m_format(format), m_stopping(false), m_thread(&ChunkStore::run, this) {
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+}
+
+ChunkStore::~ChunkStore() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+
+    m_wakeUp.notify_one();
+    m_thread.join();
+}
+
+ChunkStore::World ChunkStore::loadWorld(const std::string& directory, int seed,
+                                        uint64_t generator) {
+    std::string seedPath = directory + "/seed", generatorPath = directory + "/generator";
+
+    std::ifstream in(seedPath);
+    int savedSeed;
+    if (in >> savedSeed) {
+        std::ifstream generatorIn(generatorPath);
+        uint64_t savedGenerator;
+        bool same = bool(generatorIn >> std::hex >> savedGenerator) && savedGenerator == generator;
+
+        return World{savedSeed, same};
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    std::ofstream(seedPath) << seed << std::endl;
+    std::ofstream(generatorPath) << std::hex << generator << std::endl;
+
+    return World{seed, true};
+}
+
+void ChunkStore::requestLoad(int x, int z) {
+    submit([this, x, z] { m_loaded.push(readChunk(x, z)); });
+}
+
+ChunkStore::LoadResult ChunkStore::load(int x, int z) {
+    std::promise<LoadResult> result;
+    submit([this, x, z, &result] { result.set_value(readChunk(x, z)); });
+
+    return result.get_future().get();
+}
+
+void ChunkStore::save(Chunk chunk) {
+    submit([this, chunk = std::move(chunk)] { writeChunk(chunk); });
+}
+
+void ChunkStore::saveEdits(int x, int z, EditLog edits) {
+    submit([this, x, z, edits = std::move(edits)]() mutable { writeEdits(x, z, edits); });
+}
+
+void ChunkStore::submit(Task task) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.push_back(std::move(task));
+    }
+
+    m_wakeUp.notify_one();
+}
+
+// Outstanding tasks are all finished before the thread stops, so that no save is
+// ever lost
+void ChunkStore::run() {
+    while (true) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeUp.wait(lock, [this] { return m_stopping || !m_tasks.empty(); });
+            if (m_tasks.empty()) return;
+
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+
+        task();
+    }
+}
+
+RegionFile* ChunkStore::region(int x, int z) {
+    std::pair<int, int> location(floorDiv(x, RegionFile::SIZE), floorDiv(z, RegionFile::SIZE));
+
+    auto i = m_regions.find(location);
+    if (i != m_regions.end()) return i->second.get();
+
+    // The player rarely wanders far, so when there are too many open files they
+    // are simply all closed, except for those which loaded chunks still refer to
+    if (m_regions.size() >= MAX_OPEN_REGIONS) {
+        for (auto j = m_regions.begin(); j != m_regions.end();) {
+            j = j->second->inUse() ? std::next(j) : m_regions.erase(j);
+        }
+    }
+
+    std::ostringstream path;
+    path << m_directory << "/r." << location.first << "." << location.second << ".region";
+
+    std::unique_ptr<RegionFile> file(new RegionFile(path.str()));
+    if (!file->isOpen()) {
+        std::cerr << "Failed to open " << path.str() << std::endl;
+        return nullptr;
+    }
+
+    return (m_regions[location] = std::move(file)).get();
+}
+
+// Each saved chunk starts with its size before compression, with the top bit set
+// if it isn't compressed, and the next bit set if it is only an edit log. A
+// compressed chunk follows with the zlib stream, an uncompressed one with padding
+// and then the chunk itself, 8-byte aligned, and an edit log with the log itself.
+static const uint32_t UNCOMPRESSED_BIT = 1u << 31;
+static const uint32_t EDIT_LOG_BIT = 1u << 30;
+static const size_t UNCOMPRESSED_HEADER = 8;
+
+ChunkStore::LoadResult ChunkStore::readChunk(int x, int z) {
+    LoadResult result{x, z, std::nullopt, std::nullopt};
+    RegionFile* file = region(x, z);
+
+    RegionFile::Data data;
+    int i = x - floorDiv(x, RegionFile::SIZE) * RegionFile::SIZE;
+    int j = z - floorDiv(z, RegionFile::SIZE) * RegionFile::SIZE;
+    if (!file || !file->read(i, j, data)) return result;
+
+    ByteReader reader(data.bytes, data.size);
+    uint32_t header = reader.getInteger<uint32_t>();
+    uLongf size = header & ~(UNCOMPRESSED_BIT | EDIT_LOG_BIT);
+    if (reader.failed() || size > MAX_CHUNK_SIZE) return result;
+
+    const size_t HEADER = sizeof(uint32_t);
+    if (header & EDIT_LOG_BIT) {
+        if (data.size < HEADER + size) return result;
+        result.edits = EditLog::read(data.bytes + HEADER, size);
+        return result;
+    }
+
+    if (header & UNCOMPRESSED_BIT) {
+        if (data.size < UNCOMPRESSED_HEADER + size) return result;
+        result.chunk = Chunk::read(data.bytes + UNCOMPRESSED_HEADER, size, data.mapping);
+    } else {
+        std::vector<uint8_t> bytes(size);
+        if (uncompress(bytes.data(), &size, data.bytes + HEADER, data.size - HEADER) != Z_OK ||
+            size != bytes.size()) {
+            return result;
+        }
+
+        result.chunk = Chunk::read(bytes.data(), bytes.size());
+    }
+
+    if (result.chunk && (result.chunk->x() != x || result.chunk->z() != z)) result.chunk.reset();
+
+    return result;
+}
+
+void ChunkStore::writeChunk(const Chunk& chunk) {
+    std::vector<uint8_t> data;
+    if (m_format == UNCOMPRESSED) {
+        data.resize(UNCOMPRESSED_HEADER);
+        chunk.write(data);
+
+        std::vector<uint8_t> header;
+        putInteger<uint32_t>(header, (data.size() - UNCOMPRESSED_HEADER) | UNCOMPRESSED_BIT);
+        std::copy(header.begin(), header.end(), data.begin());
+    } else {
+        std::vector<uint8_t> bytes;
+        chunk.write(bytes);
+        putInteger<uint32_t>(data, bytes.size());
+
+        const size_t HEADER = data.size();
+        uLongf size = compressBound(bytes.size());
+        data.resize(HEADER + size);
+        if (compress(data.data() + HEADER, &size, bytes.data(), bytes.size()) != Z_OK) return;
+        data.resize(HEADER + size);
+    }
+
+    writeData(chunk.x(), chunk.z(), data);
+}
+
+void ChunkStore::writeEdits(int x, int z, EditLog& edits) {
+    std::vector<uint8_t> data(sizeof(uint32_t));
+    edits.write(data);
+
+    std::vector<uint8_t> header;
+    putInteger<uint32_t>(header, (data.size() - sizeof(uint32_t)) | EDIT_LOG_BIT);
+    std::copy(header.begin(), header.end(), data.begin());
+
+    writeData(x, z, data);
+}
+
+void ChunkStore::writeData(int x, int z, const std::vector<uint8_t>& data) {
+    RegionFile* file = region(x, z);
+    int i = x - floorDiv(x, RegionFile::SIZE) * RegionFile::SIZE;
+    int j = z - floorDiv(z, RegionFile::SIZE) * RegionFile::SIZE;
+    if (!file || !file->write(i, j, data)) {
+        std::cerr << "Failed to save chunk (" << x << ", " << z << ")" << std::endl;
+    }
+}
@@ -0,0 +1,95 @@
+#include "edit_log.hpp"
+
+#include <algorithm>
+
+#include "byte_stream.hpp"
+
+void EditLog::record(const Coordinate& location, std::optional<BlockLibrary::Tag> tag) {
+    if (location.y < 0 || location.y >= Chunk::DEPTH) return;
+
+    // Chunk sizes are powers of two, so masking gives the position within the
+    // chunk even for negative coordinates
+    int i = location.x & (Chunk::SIZE - 1);
+    int j = location.z & (Chunk::SIZE - 1);
+    uint16_t position = (i * Chunk::SIZE + j) * Chunk::DEPTH + location.y;
+
+    m_edits.push_back(Edit{position, uint8_t(tag ? *tag + 1 : 0)});
+    if (m_edits.size() >= 2 * m_compactedSize + 64) compact();
+}
+
+void EditLog::compact() {
+    // The sort is stable, so the last edit to each position is the last of its run
+    std::stable_sort(m_edits.begin(), m_edits.end(),
+                     [](const Edit& a, const Edit& b) { return a.position < b.position; });
+
+    size_t kept = 0;
+    for (size_t i = 0; i < m_edits.size(); ++i) {
+        if (i + 1 < m_edits.size() && m_edits[i + 1].position == m_edits[i].position) continue;
+        m_edits[kept++] = m_edits[i];
+    }
+
+    m_edits.resize(kept);
+    m_compactedSize = kept;
+}
+
+void EditLog::apply(Chunk& chunk) {
+    compact();
+
+    size_t kept = 0;
+    for (const Edit& edit : m_edits) {
+        int i = edit.position / (Chunk::SIZE * Chunk::DEPTH);
+        int j = edit.position / Chunk::DEPTH % Chunk::SIZE;
+        Coordinate location(chunk.x() * Chunk::SIZE + i, edit.position % Chunk::DEPTH,
+                            chunk.z() * Chunk::SIZE + j);
+
+        std::optional<BlockLibrary::Tag> current = chunk.get(location);
+        if (edit.block == 0) {
+            if (!current) continue;
+            chunk.removeBlock(location);
+        } else {
+            if (current && *current + 1 == edit.block) continue;
+            chunk.newBlock(location.x, location.y, location.z, edit.block - 1);
+        }
+
+        m_edits[kept++] = edit;
+    }
+
+    m_edits.resize(kept);
+    m_compactedSize = kept;
+}
+
+void EditLog::write(std::vector<uint8_t>& out) {
+    compact();
+
+    putInteger<uint32_t>(out, m_edits.size());
+    for (const Edit& edit : m_edits) {
+        putInteger(out, edit.position);
+        putInteger(out, edit.block);
+    }
+}
+
+std::optional<EditLog> EditLog::read(const uint8_t* data, size_t size) {
+    ByteReader reader(data, size);
+    size_t count = reader.getInteger<uint32_t>();
+    if (count > POSITIONS) return std::nullopt;
+
+    EditLog log;
+    log.m_edits.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        Edit& edit = log.m_edits[i];
+        edit.position = reader.getInteger<uint16_t>();
+        edit.block = reader.getInteger<uint8_t>();
+
+        // The log is saved compacted, so positions are strictly increasing
+        if (edit.position >= POSITIONS) return std::nullopt;
+        if (i > 0 && edit.position <= log.m_edits[i - 1].position) return std::nullopt;
+
+        // Blocks are tags plus one, or zero for a removed block
+        if (edit.block > BlockLibrary::TYPES) return std::nullopt;
+    }
+
+    if (reader.failed() || !reader.atEnd()) return std::nullopt;
+
+    log.m_compactedSize = count;
+    return log;
+}
@@ -0,0 +1,44 @@
+#include "frustum.hpp"
+
+#include <cmath>
+
+Frustum::Frustum(const glm::mat4& viewProjection) {
+    // A point p is inside when -w <= x, y, z <= w in clip space, so each plane is
+    // the last row of the matrix plus or minus one of the other rows
+    for (int i = 0; i < PLANES; ++i) {
+        int row = i / 2;
+        float sign = (i % 2 == 0) ? 1.0f : -1.0f;
+
+        glm::vec4 plane;
+        for (int column = 0; column < 4; ++column) {
+            plane[column] = viewProjection[column][3] + sign * viewProjection[column][row];
+        }
+
+        m_x[i] = plane.x;
+        m_y[i] = plane.y;
+        m_z[i] = plane.z;
+        m_w[i] = plane.w;
+    }
+
+    for (int i = PLANES; i < PADDED_PLANES; ++i) {
+        m_x[i] = m_y[i] = m_z[i] = 0.0f;
+        m_w[i] = 1.0f;
+    }
+}
+
+bool Frustum::intersects(const glm::vec3& min, const glm::vec3& max) const {
+    glm::vec3 center = 0.5f * (min + max);
+    glm::vec3 extent = 0.5f * (max - min);
+
+    // The box is outside of a plane if its corner furthest along the plane's
+    // normal is behind it. There is no early exit, so that the loop vectorizes.
+    bool outside = false;
+    for (int i = 0; i < PADDED_PLANES; ++i) {
+        float distance = m_x[i] * center.x + m_y[i] * center.y + m_z[i] * center.z + m_w[i];
+        float radius = std::abs(m_x[i]) * extent.x + std::abs(m_y[i]) * extent.y +
+                       std::abs(m_z[i]) * extent.z;
+        outside |= (distance + radius < 0.0f);
+    }
+
+    return !outside;
+}
@@ -0,0 +1,81 @@
+#include "job_system.hpp"
+
+#include <algorithm>
+
+size_t JobSystem::defaultThreadCount() {
+    size_t hardwareThreads = std::thread::hardware_concurrency();
+    return std::max<size_t>(hardwareThreads, 2) - 1;
+}
+
+JobSystem::JobSystem(size_t threads) : m_nextWorker(0), m_queued(0), m_stopping(false) {
+    for (size_t i = 0; i < threads; ++i) m_workers.emplace_back(new Worker);
+    for (size_t i = 0; i < threads; ++i) m_threads.emplace_back(&JobSystem::run, this, i);
+}
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_stopping = true;
+    }
+
+    m_wakeUp.notify_all();
+    for (std::thread& thread : m_threads) thread.join();
+}
+
+void JobSystem::submit(Job job) {
+    // The count goes up before the job is visible, so that a worker which takes
+    // the job straight away can never take the count below zero
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        ++m_queued;
+    }
+
+    Worker& worker = *m_workers[m_nextWorker++ % m_workers.size()];
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.jobs.push_back(std::move(job));
+    }
+
+    m_wakeUp.notify_one();
+}
+
+bool JobSystem::takeJob(size_t index, Job& job) {
+    Worker& own = *m_workers[index];
+    {
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty()) {
+            job = std::move(own.jobs.front());
+            own.jobs.pop_front();
+            return true;
+        }
+    }
+
+    // Steal from the opposite end to the owner, to keep out of its way
+    for (size_t i = 1; i < m_workers.size(); ++i) {
+        Worker& victim = *m_workers[(index + i) % m_workers.size()];
+
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty()) {
+            job = std::move(victim.jobs.back());
+            victim.jobs.pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void JobSystem::run(size_t index) {
+    while (true) {
+        Job job;
+        if (takeJob(index, job)) {
+            --m_queued;
+            job();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        m_wakeUp.wait(lock, [this] { return m_stopping || m_queued > 0; });
+        if (m_stopping) return;
+    }
+}
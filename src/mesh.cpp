@@ -1,7 +1,16 @@
 #include "mesh.hpp"
 
-#include <glm/gtc/type_ptr.hpp>
+#include <cassert>
 
-void copyVector(GLfloat* dest, const glm::vec3& source) {
-    memcpy(dest, glm::value_ptr(source), 3 * sizeof(GLfloat));
-}
\ No newline at end of file
+Vertex packVertex(int chunkX, int chunkZ, const glm::ivec3& position, int face, int layer) {
+    assert(position.x >= 0 && position.x <= 16);
+    assert(position.y >= 0 && position.y <= 64);
+    assert(position.z >= 0 && position.z <= 16);
+    assert(face >= 0 && face < 6);
+
+    Vertex vertex;
+    vertex.position = GLuint(position.x) | (GLuint(position.y) << 5) | (GLuint(position.z) << 12) |
+                      ((GLuint(chunkX) & 127) << 17) | ((GLuint(chunkZ) & 127) << 24);
+    vertex.texture = GLuint(face) | (GLuint(layer) << 3);
+    return vertex;
+}
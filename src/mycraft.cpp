@@ -79,10 +79,24 @@ void keyCallback(GLFWwindow *, int key, int /*scancode*/, int action, int /*mods
 
         glm::vec3 gaze = camera.gaze();
         std::cout << "Camera gaze = " << gaze.x << ", " << gaze.y << ", " << gaze.z << std::endl;
+
+        BufferArena::Stats meshMemory = chunkManager->meshMemory();
+        std::cout << "Mesh memory: " << meshMemory.used / 1024 << "KB used of "
+                  << meshMemory.capacity / 1024 << "KB, in " << meshMemory.allocations
+                  << " meshes and " << meshMemory.buffers << " buffers" << std::endl;
     } else if ((key == 'B' || key == GLFW_KEY_TAB) && action == GLFW_PRESS) {
         selectedBlock = (selectedBlock + 1) % renderer->blockLibrary().size();
     } else if (key == GLFW_KEY_SPACE && action == GLFW_PRESS) {
         player->jump();
+    } else if (key == 'G' && action == GLFW_PRESS) {
+        // Switch between greedy and one-quad-per-face meshing, for comparison
+        chunkManager->setGreedyMeshing(!chunkManager->greedyMeshing());
+        std::cout << "Greedy meshing: " << (chunkManager->greedyMeshing() ? "on" : "off")
+                  << std::endl;
+    } else if (key == 'O' && action == GLFW_PRESS) {
+        chunkManager->setOcclusionCulling(!chunkManager->occlusionCulling());
+        std::cout << "Occlusion culling: " << (chunkManager->occlusionCulling() ? "on" : "off")
+                  << std::endl;
     }
 }
 
@@ -113,7 +127,21 @@ void mouseButtonCallback(GLFWwindow *window, int button, int action, int /*mods*
     }
 }
 
-int main() {
+int main(int argc, char *argv[]) {
+    // Chunks are saved uncompressed unless asked otherwise, so that they can be
+    // used straight from the mapped region files
+    ChunkStore::Format format = ChunkStore::UNCOMPRESSED;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--compressed") == 0) {
+            format = ChunkStore::COMPRESSED;
+        } else if (strcmp(argv[i], "--save-edits") == 0) {
+            format = ChunkStore::EDITS;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--compressed | --save-edits]" << std::endl;
+            return 1;
+        }
+    }
+
     // Initialize glfw
     if (!glfwInit()) {
         std::cerr << "Failed to initialize glfw" << std::endl;
@@ -152,7 +180,7 @@ int main() {
     glfwSetInputMode(window, GLFW_STICKY_MOUSE_BUTTONS, GLFW_TRUE);
 
     srand(time(0));
-    chunkManager = new ChunkManager(rand());
+    chunkManager = new ChunkManager(rand(), "world", format);
     renderer = new Renderer(INITIAL_WIDTH, INITIAL_HEIGHT);
 
     // Start up in the air
@@ -185,6 +213,11 @@ int main() {
                 player->step(Player::DOWN);
         */
 
+        // The ground has to be there before the player can land on it
+        glm::vec3 reachMin, reachMax;
+        player->reach(elapsed, reachMin, reachMax);
+        chunkManager->loadNow(reachMin, reachMax);
+
         player->update(elapsed);
 
         if (mouseCaptured && glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
@@ -203,14 +236,22 @@ int main() {
             }
         }
 
-        std::vector<const Mesh *> visibleMeshes = chunkManager->getVisibleMeshes(player->camera());
-        renderer->render(player->camera(), visibleMeshes, player->isUnderwater(), selectedBlock);
+        const Camera &camera = player->camera();
+        Frustum frustum(renderer->viewProjectionMatrix(camera));
+        std::vector<const Mesh *> visibleMeshes = chunkManager->getVisibleMeshes(camera, frustum);
+        renderer->render(camera, visibleMeshes, player->isUnderwater(), selectedBlock);
 
         glfwSwapBuffers(window);
 
         fpsCounter.frame();
     }
 
+    // The world is saved while the chunk manager is destroyed, and its meshes
+    // need the OpenGL context to still be around
+    delete player;
+    delete renderer;
+    delete chunkManager;
+
     // Close OpenGL window and terminate glfw
     glfwTerminate();
     return 0;
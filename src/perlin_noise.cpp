@@ -1,18 +1,25 @@
 #include "perlin_noise.hpp"
 
+#include <algorithm>
 #include <cmath>
 #include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <utility>
 
 PerlinNoise::PerlinNoise(unsigned int seed) {
-    // Permute the integers 0-255 using the seed
-    srand(seed);
+    // Permute the integers 0-255 using the seed. The output of mt19937 is fully
+    // specified by the standard, unlike rand() or the standard distributions, so
+    // the permutation is the same on every platform.
+    std::mt19937 rng(seed);
 
     uint8_t permutation[256];
     for (size_t i = 0; i < 256; ++i) permutation[i] = i;
 
     for (size_t i = 0; i < 256; ++i) {
-        int j = i + rand() % (256 - i);
+        int j = i + rng() % (256 - i);
         std::swap(permutation[i], permutation[j]);
     }
 
@@ -22,7 +29,49 @@ PerlinNoise::PerlinNoise(unsigned int seed) {
     }
 }
 
-float PerlinNoise::sample(float x, float y, float z) {
+// Generators are only ever added, so references to them stay valid, and they are
+// never changed once they have been built
+const PerlinNoise& PerlinNoise::forSeed(unsigned int seed) {
+    static std::mutex mutex;
+    static std::map<unsigned int, std::unique_ptr<const PerlinNoise>> generators;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unique_ptr<const PerlinNoise>& generator = generators[seed];
+    if (!generator) generator.reset(new PerlinNoise(seed));
+
+    return *generator;
+}
+
+void PerlinNoise::hash(uint8_t X, uint8_t Y, uint8_t Z, int hashes[8]) const {
+    int A = p[X] + Y, AA = p[A] + Z, AB = p[A + 1] + Z, B = p[X + 1] + Y, BA = p[B] + Z,
+        BB = p[B + 1] + Z;
+
+    hashes[0] = p[AA];
+    hashes[1] = p[BA];
+    hashes[2] = p[AB];
+    hashes[3] = p[BB];
+    hashes[4] = p[AA + 1];
+    hashes[5] = p[BA + 1];
+    hashes[6] = p[AB + 1];
+    hashes[7] = p[BB + 1];
+}
+
+float PerlinNoise::blend(float x, float y, float z, const int hashes[8]) {
+    // Compute fade curves for each of x, y, z
+    float u = fade(x), v = fade(y), w = fade(z);
+
+    // Blend results from the 8 corners of the cube
+    float result =
+        lerp(w,
+             lerp(v, lerp(u, grad(hashes[0], x, y, z), grad(hashes[1], x - 1, y, z)),
+                  lerp(u, grad(hashes[2], x, y - 1, z), grad(hashes[3], x - 1, y - 1, z))),
+             lerp(v, lerp(u, grad(hashes[4], x, y, z - 1), grad(hashes[5], x - 1, y, z - 1)),
+                  lerp(u, grad(hashes[6], x, y - 1, z - 1), grad(hashes[7], x - 1, y - 1, z - 1))));
+
+    return result;
+}
+
+float PerlinNoise::sample(float x, float y, float z) const {
     // Find unit cube that contains the point
     uint8_t X = floor(x);
     uint8_t Y = floor(y);
@@ -33,22 +82,257 @@ float PerlinNoise::sample(float x, float y, float z) {
     y -= floor(y);
     z -= floor(z);
 
-    // Compute fade curves for each of x, y, z
-    float u = fade(x), v = fade(y), w = fade(z);
-
     // Hash coordinates of the 8 cube corners
-    int A = p[X] + Y, AA = p[A] + Z, AB = p[A + 1] + Z, B = p[X + 1] + Y, BA = p[B] + Z,
-        BB = p[B + 1] + Z;
+    int hashes[8];
+    hash(X, Y, Z, hashes);
 
-    // Blend results from the 8 corners of the cube
-    float result =
-        lerp(w,
-             lerp(v, lerp(u, grad(p[AA], x, y, z), grad(p[BA], x - 1, y, z)),
-                  lerp(u, grad(p[AB], x, y - 1, z), grad(p[BB], x - 1, y - 1, z))),
-             lerp(v, lerp(u, grad(p[AA + 1], x, y, z - 1), grad(p[BA + 1], x - 1, y, z - 1)),
-                  lerp(u, grad(p[AB + 1], x, y - 1, z - 1), grad(p[BB + 1], x - 1, y - 1, z - 1))));
+    return blend(x, y, z, hashes);
+}
 
-    return result;
+// Points are sampled in blocks. A kernel finds the unit cube around each point
+// of the block, then the corners are hashed one point at a time, since that is
+// nothing but table lookups, and then a kernel blends the whole block at once.
+// The kernels do exactly the same operations in the same order as sample(), so
+// that the results are identical down to the last bit.
+namespace {
+
+const size_t BLOCK = 64;
+
+struct Block {
+    // The points, which locate() replaces with their positions within their
+    // unit cubes
+    alignas(32) float x[BLOCK], y[BLOCK], z[BLOCK];
+    alignas(32) int32_t cubes[3][BLOCK];
+
+    // Only the low 4 bits of each corner hash are used by grad()
+    alignas(32) int32_t hashes[8][BLOCK];
+    alignas(32) float result[BLOCK];
+};
+
+struct Kernel {
+    void (*locate)(Block& block);
+    void (*blend)(Block& block);
+};
+
+}  // namespace
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+namespace {
+
+// SSE2 is part of x86-64, so this kernel needs no check
+__m128 fadeSse2(__m128 t) {
+    __m128 cube = _mm_mul_ps(_mm_mul_ps(t, t), t);
+    __m128 poly = _mm_sub_ps(_mm_mul_ps(t, _mm_set1_ps(6)), _mm_set1_ps(15));
+    return _mm_mul_ps(cube, _mm_add_ps(_mm_mul_ps(t, poly), _mm_set1_ps(10)));
+}
+
+__m128 lerpSse2(__m128 t, __m128 a, __m128 b) {
+    return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a)));
+}
+
+__m128 selectSse2(__m128i mask, __m128 a, __m128 b) {
+    __m128 m = _mm_castsi128_ps(mask);
+    return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+}
+
+// Truncation rounds negative numbers up, so those are stepped back down. Floats
+// of 2^23 and up are already whole, and converting one of 2^31 or more gives the
+// same out of range value as sample() does.
+__m128 floorSse2(__m128 x, __m128i& whole) {
+    __m128i truncated = _mm_cvttps_epi32(x);
+    __m128 result = _mm_cvtepi32_ps(truncated);
+
+    __m128 magnitude = _mm_andnot_ps(_mm_set1_ps(-0.0f), x);
+    __m128 big = _mm_cmpge_ps(magnitude, _mm_set1_ps(8388608.0f));
+    __m128 roundedUp = _mm_andnot_ps(big, _mm_cmplt_ps(x, result));
+
+    whole = _mm_add_epi32(truncated, _mm_castps_si128(roundedUp));
+    result = _mm_sub_ps(result, _mm_and_ps(roundedUp, _mm_set1_ps(1)));
+    return _mm_or_ps(_mm_and_ps(big, x), _mm_andnot_ps(big, result));
+}
+
+void locateSse2(Block& block) {
+    float* coordinates[3] = {block.x, block.y, block.z};
+    for (int axis = 0; axis < 3; ++axis) {
+        for (size_t i = 0; i < BLOCK; i += 4) {
+            __m128 x = _mm_load_ps(coordinates[axis] + i);
+
+            __m128i whole;
+            __m128 floor = floorSse2(x, whole);
+            _mm_store_si128(reinterpret_cast<__m128i*>(block.cubes[axis] + i), whole);
+            _mm_store_ps(coordinates[axis] + i, _mm_sub_ps(x, floor));
+        }
+    }
+}
+
+// The branches of grad() become selects, and the signs are flipped by setting
+// the sign bit
+__m128 gradSse2(__m128i h, __m128 x, __m128 y, __m128 z) {
+    __m128 u = selectSse2(_mm_cmpgt_epi32(_mm_set1_epi32(8), h), x, y);
+
+    __m128i xForV = _mm_or_si128(_mm_cmpeq_epi32(h, _mm_set1_epi32(12)),
+                                 _mm_cmpeq_epi32(h, _mm_set1_epi32(14)));
+    __m128 v = selectSse2(_mm_cmpgt_epi32(_mm_set1_epi32(4), h), y, selectSse2(xForV, x, z));
+
+    u = _mm_xor_ps(u, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(1)), 31)));
+    v = _mm_xor_ps(v, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(2)), 30)));
+    return _mm_add_ps(_mm_add_ps(_mm_setzero_ps(), u), v);
+}
+
+void blendSse2(Block& block) {
+    const __m128 one = _mm_set1_ps(1);
+    for (size_t i = 0; i < BLOCK; i += 4) {
+        __m128 x0 = _mm_load_ps(block.x + i), x1 = _mm_sub_ps(x0, one);
+        __m128 y0 = _mm_load_ps(block.y + i), y1 = _mm_sub_ps(y0, one);
+        __m128 z0 = _mm_load_ps(block.z + i), z1 = _mm_sub_ps(z0, one);
+        __m128 u = fadeSse2(x0), v = fadeSse2(y0), w = fadeSse2(z0);
+
+        __m128 g[8];
+        for (int c = 0; c < 8; ++c) {
+            __m128i h = _mm_load_si128(reinterpret_cast<const __m128i*>(block.hashes[c] + i));
+            g[c] = gradSse2(h, (c & 1) ? x1 : x0, (c & 2) ? y1 : y0, (c & 4) ? z1 : z0);
+        }
+
+        __m128 result =
+            lerpSse2(w, lerpSse2(v, lerpSse2(u, g[0], g[1]), lerpSse2(u, g[2], g[3])),
+                     lerpSse2(v, lerpSse2(u, g[4], g[5]), lerpSse2(u, g[6], g[7])));
+        _mm_store_ps(block.result + i, result);
+    }
+}
+
+// The AVX2 kernel is the same thing eight points at a time. It is only used if
+// the CPU turns out to support it. FMA is left out on purpose, since fusing the
+// multiplies and adds would change the rounding.
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 void locateAvx2(Block& block) {
+    float* coordinates[3] = {block.x, block.y, block.z};
+    for (int axis = 0; axis < 3; ++axis) {
+        for (size_t i = 0; i < BLOCK; i += 8) {
+            __m256 x = _mm256_load_ps(coordinates[axis] + i);
+            __m256 floor = _mm256_floor_ps(x);
+
+            __m256i whole = _mm256_cvttps_epi32(floor);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(block.cubes[axis] + i), whole);
+            _mm256_store_ps(coordinates[axis] + i, _mm256_sub_ps(x, floor));
+        }
+    }
+}
+
+AVX2 __m256 fadeAvx2(__m256 t) {
+    __m256 cube = _mm256_mul_ps(_mm256_mul_ps(t, t), t);
+    __m256 poly = _mm256_sub_ps(_mm256_mul_ps(t, _mm256_set1_ps(6)), _mm256_set1_ps(15));
+    return _mm256_mul_ps(cube, _mm256_add_ps(_mm256_mul_ps(t, poly), _mm256_set1_ps(10)));
+}
+
+AVX2 __m256 lerpAvx2(__m256 t, __m256 a, __m256 b) {
+    return _mm256_add_ps(a, _mm256_mul_ps(t, _mm256_sub_ps(b, a)));
+}
+
+AVX2 __m256 selectAvx2(__m256i mask, __m256 a, __m256 b) {
+    return _mm256_blendv_ps(b, a, _mm256_castsi256_ps(mask));
+}
+
+AVX2 __m256 gradAvx2(__m256i h, __m256 x, __m256 y, __m256 z) {
+    __m256 u = selectAvx2(_mm256_cmpgt_epi32(_mm256_set1_epi32(8), h), x, y);
+
+    __m256i xForV = _mm256_or_si256(_mm256_cmpeq_epi32(h, _mm256_set1_epi32(12)),
+                                    _mm256_cmpeq_epi32(h, _mm256_set1_epi32(14)));
+    __m256 v =
+        selectAvx2(_mm256_cmpgt_epi32(_mm256_set1_epi32(4), h), y, selectAvx2(xForV, x, z));
+
+    __m256i uSign = _mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(1)), 31);
+    __m256i vSign = _mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(2)), 30);
+    u = _mm256_xor_ps(u, _mm256_castsi256_ps(uSign));
+    v = _mm256_xor_ps(v, _mm256_castsi256_ps(vSign));
+    return _mm256_add_ps(_mm256_add_ps(_mm256_setzero_ps(), u), v);
+}
+
+AVX2 void blendAvx2(Block& block) {
+    const __m256 one = _mm256_set1_ps(1);
+    for (size_t i = 0; i < BLOCK; i += 8) {
+        __m256 x0 = _mm256_load_ps(block.x + i), x1 = _mm256_sub_ps(x0, one);
+        __m256 y0 = _mm256_load_ps(block.y + i), y1 = _mm256_sub_ps(y0, one);
+        __m256 z0 = _mm256_load_ps(block.z + i), z1 = _mm256_sub_ps(z0, one);
+        __m256 u = fadeAvx2(x0), v = fadeAvx2(y0), w = fadeAvx2(z0);
+
+        __m256 g[8];
+        for (int c = 0; c < 8; ++c) {
+            __m256i h =
+                _mm256_load_si256(reinterpret_cast<const __m256i*>(block.hashes[c] + i));
+            g[c] = gradAvx2(h, (c & 1) ? x1 : x0, (c & 2) ? y1 : y0, (c & 4) ? z1 : z0);
+        }
+
+        __m256 result =
+            lerpAvx2(w, lerpAvx2(v, lerpAvx2(u, g[0], g[1]), lerpAvx2(u, g[2], g[3])),
+                     lerpAvx2(v, lerpAvx2(u, g[4], g[5]), lerpAvx2(u, g[6], g[7])));
+        _mm256_store_ps(block.result + i, result);
+    }
+}
+
+#undef AVX2
+
+Kernel chooseKernel() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return Kernel{locateAvx2, blendAvx2};
+    } else {
+        return Kernel{locateSse2, blendSse2};
+    }
+}
+
+}  // namespace
+
+#else
+
+namespace {
+
+Kernel chooseKernel() { return Kernel{nullptr, nullptr}; }
+
+}  // namespace
+
+#endif
+
+void PerlinNoise::sample(const float* x, const float* y, const float* z, size_t count,
+                         float* out) const {
+    // Without kernels, the points are simply sampled one at a time
+    static const Kernel kernel = chooseKernel();
+    if (!kernel.blend) {
+        for (size_t i = 0; i < count; ++i) out[i] = sample(x[i], y[i], z[i]);
+        return;
+    }
+
+    Block block;
+    for (size_t first = 0; first < count; first += BLOCK) {
+        // A partial block is padded out with the last point
+        size_t size = std::min(BLOCK, count - first);
+        for (size_t i = 0; i < BLOCK; ++i) {
+            size_t point = first + std::min(i, size - 1);
+            block.x[i] = x[point];
+            block.y[i] = y[point];
+            block.z[i] = z[point];
+        }
+
+        kernel.locate(block);
+
+        // Neighboring points are often in the same cube, such as when sampling
+        // along a line, so the last hashes are reused when they can be
+        int hashes[8];
+        for (size_t i = 0; i < BLOCK; ++i) {
+            if (i == 0 || block.cubes[0][i] != block.cubes[0][i - 1] ||
+                block.cubes[1][i] != block.cubes[1][i - 1] ||
+                block.cubes[2][i] != block.cubes[2][i - 1]) {
+                hash(block.cubes[0][i], block.cubes[1][i], block.cubes[2][i], hashes);
+            }
+
+            for (int c = 0; c < 8; ++c) block.hashes[c][i] = hashes[c] & 0xF;
+        }
+
+        kernel.blend(block);
+        std::copy(block.result, block.result + size, out + first);
+    }
 }
 
 float PerlinNoise::fade(float t) { return t * t * t * (t * (t * 6 - 15) + 10); }
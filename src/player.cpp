@@ -197,12 +197,24 @@ void Player::update(float elapsed) {
     if (delta != glm::vec3(0.0f)) resolveCollisions(delta);
 
     m_camera.eye += delta;
+    m_camera.velocity = (elapsed > 0) ? delta / elapsed : glm::vec3(0.0f);
     m_step = glm::vec3(0.0f);
 }
 
+void Player::reach(float elapsed, glm::vec3& min, glm::vec3& max) const {
+    // Gravity and air resistance only ever slow the player down horizontally, and
+    // chunks span the full height of the world, so an extra block of slack in y
+    // is plenty
+    glm::vec3 speed = glm::abs(m_step) + glm::abs(m_velocity);
+    glm::vec3 slack = speed * elapsed + glm::vec3(0.0f, 1.0f, 0.0f);
+
+    min = m_camera.eye - glm::vec3(0.3f, EYE_HEIGHT, 0.3f) - slack;
+    max = m_camera.eye + glm::vec3(0.3f, PLAYER_HEIGHT - EYE_HEIGHT, 0.3f) + slack;
+}
+
 bool Player::isUnderwater() const {
     Coordinate currentBlock = m_camera.eye;
-    const Block* block = m_chunkManager.getBlock(currentBlock);
+    std::optional<BlockLibrary::Tag> block = m_chunkManager.getBlock(currentBlock);
 
-    return (block && block->blockType == BlockLibrary::WATER);
+    return (block && *block == BlockLibrary::WATER);
 }
@@ -0,0 +1,177 @@
+#include "region_file.hpp"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+
+#include "byte_stream.hpp"
+
+RegionFile::RegionFile(const std::string& path)
+: m_file(std::fopen(path.c_str(), "r+b")), m_mappedSize(0) {
+    m_table.fill(Entry{0, 0});
+    m_usedSectors.assign(TABLE_SECTORS, true);
+
+    // A new file starts with an empty table
+    if (!m_file) {
+        m_file = std::fopen(path.c_str(), "w+b");
+        if (!m_file) return;
+
+        std::vector<uint8_t> table(TABLE_SECTORS * SECTOR_SIZE, 0);
+        if (std::fwrite(&table[0], 1, table.size(), m_file) != table.size()) {
+            std::fclose(m_file);
+            m_file = nullptr;
+        }
+
+        return;
+    }
+
+    std::vector<uint8_t> table(TABLE_SECTORS * SECTOR_SIZE);
+    std::fseek(m_file, 0, SEEK_END);
+    long fileSize = std::ftell(m_file);
+    std::fseek(m_file, 0, SEEK_SET);
+    if (std::fread(&table[0], 1, table.size(), m_file) != table.size()) {
+        std::fclose(m_file);
+        m_file = nullptr;
+        return;
+    }
+
+    // Entries which point outside of the file, perhaps because of a crash while
+    // it was being extended, are treated as never having been saved
+    size_t fileSectors = sectorsFor(fileSize);
+    m_usedSectors.resize(fileSectors, false);
+
+    ByteReader reader(&table[0], table.size());
+    for (Entry& entry : m_table) {
+        entry.sector = reader.getInteger<uint32_t>();
+        entry.size = reader.getInteger<uint32_t>();
+
+        size_t sectors = sectorsFor(entry.size);
+        if (entry.sector < TABLE_SECTORS || entry.sector + sectors > fileSectors) {
+            entry = Entry{0, 0};
+            continue;
+        }
+
+        markSectors(entry.sector, sectors, true);
+    }
+}
+
+RegionFile::~RegionFile() {
+    if (m_file) std::fclose(m_file);
+}
+
+bool RegionFile::inUse() {
+    m_oldMappings.erase(std::remove_if(m_oldMappings.begin(), m_oldMappings.end(),
+                                       [](const std::weak_ptr<const void>& mapping) {
+                                           return mapping.expired();
+                                       }),
+                        m_oldMappings.end());
+
+    // Nothing can get hold of the current mapping except through this object, so
+    // once nothing else holds it, it stays that way
+    return !m_oldMappings.empty() || m_mapping.use_count() > 1;
+}
+
+bool RegionFile::map() {
+    // Anything written so far has to reach the file before it can be mapped
+    if (std::fflush(m_file) != 0 || std::fseek(m_file, 0, SEEK_END) != 0) return false;
+    size_t size = std::ftell(m_file);
+
+    void* address = mmap(nullptr, size, PROT_READ, MAP_SHARED, fileno(m_file), 0);
+    if (address == MAP_FAILED) return false;
+
+    if (m_mapping.use_count() > 1) m_oldMappings.push_back(m_mapping);
+    m_mapping.reset(address, [size](const void* mapping) {
+        munmap(const_cast<void*>(mapping), size);
+    });
+    m_mappedSize = size;
+
+    return true;
+}
+
+bool RegionFile::read(int i, int j, Data& data) {
+    const Entry& entry = m_table[i * SIZE + j];
+    if (!m_file || entry.sector == 0) return false;
+
+    size_t offset = size_t(entry.sector) * SECTOR_SIZE;
+    if (offset + entry.size > m_mappedSize && !map()) return false;
+
+    data.mapping = m_mapping;
+    data.bytes = static_cast<const uint8_t*>(m_mapping.get()) + offset;
+    data.size = entry.size;
+    return true;
+}
+
+bool RegionFile::write(int i, int j, const std::vector<uint8_t>& data) {
+    if (!m_file) return false;
+
+    bool inUse = this->inUse();
+    if (!inUse) {
+        for (auto& sectors : m_retiredSectors) markSectors(sectors.first, sectors.second, false);
+        m_retiredSectors.clear();
+    }
+
+    int index = i * SIZE + j;
+    Entry& entry = m_table[index];
+    size_t oldSectors = entry.sector ? sectorsFor(entry.size) : 0;
+    size_t sectors = sectorsFor(data.size());
+
+    // The old data is only overwritten if the new data fits in its place and
+    // nothing might still be using it. Otherwise it stays put until the table no
+    // longer points to it, so that a crash part way through leaves one version
+    // or the other.
+    bool inPlace = sectors <= oldSectors && !inUse;
+    size_t first = inPlace ? entry.sector : findSectors(sectors);
+
+    // Whole sectors are written, so that the file always ends on a sector boundary
+    std::vector<uint8_t> padded(data);
+    padded.resize(sectors * SECTOR_SIZE, 0);
+    if (std::fseek(m_file, long(first) * SECTOR_SIZE, SEEK_SET) != 0 ||
+        std::fwrite(padded.data(), 1, padded.size(), m_file) != padded.size()) {
+        return false;
+    }
+
+    if (!inPlace) {
+        if (oldSectors) freeSectors(entry.sector, oldSectors);
+    } else {
+        markSectors(first + sectors, oldSectors - sectors, false);
+    }
+
+    markSectors(first, sectors, true);
+    entry = Entry{uint32_t(first), uint32_t(data.size())};
+    return writeEntry(index);
+}
+
+size_t RegionFile::findSectors(size_t count) const {
+    size_t run = 0;
+    for (size_t sector = TABLE_SECTORS; sector < m_usedSectors.size(); ++sector) {
+        run = m_usedSectors[sector] ? 0 : run + 1;
+        if (run == count) return sector + 1 - count;
+    }
+
+    // A free run at the end of the file can be extended
+    return m_usedSectors.size() - run;
+}
+
+void RegionFile::markSectors(size_t first, size_t count, bool used) {
+    if (first + count > m_usedSectors.size()) m_usedSectors.resize(first + count, false);
+
+    for (size_t sector = first; sector < first + count; ++sector) m_usedSectors[sector] = used;
+}
+
+void RegionFile::freeSectors(size_t first, size_t count) {
+    if (inUse()) {
+        m_retiredSectors.emplace_back(first, count);
+    } else {
+        markSectors(first, count, false);
+    }
+}
+
+bool RegionFile::writeEntry(int index) {
+    std::vector<uint8_t> bytes;
+    putInteger(bytes, m_table[index].sector);
+    putInteger(bytes, m_table[index].size);
+
+    return std::fseek(m_file, long(index) * ENTRY_SIZE, SEEK_SET) == 0 &&
+           std::fwrite(bytes.data(), 1, bytes.size(), m_file) == bytes.size() &&
+           std::fflush(m_file) == 0;
+}
@@ -5,6 +5,7 @@
 
 #include <array>
 #include <cmath>
+#include <map>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -38,9 +39,8 @@ Renderer::Renderer(int width, int height) : m_blockLibrary(new BlockLibrary) {
     m_chunkShader.programId = linkShaders(vertexShader, fragmentShader);
 
     // Input variables
-    m_chunkShader.position = glGetAttribLocation(m_chunkShader.programId, "position");
-    m_chunkShader.texCoord = glGetAttribLocation(m_chunkShader.programId, "texCoord");
-    m_chunkShader.lighting = glGetAttribLocation(m_chunkShader.programId, "lighting");
+    m_chunkShader.position = glGetAttribLocation(m_chunkShader.programId, "packedPosition");
+    m_chunkShader.texture = glGetAttribLocation(m_chunkShader.programId, "packedTexture");
 
     // Uniform variables
     m_chunkShader.vpMatrix = glGetUniformLocation(m_chunkShader.programId, "vpMatrix");
@@ -50,6 +50,23 @@ Renderer::Renderer(int width, int height) : m_blockLibrary(new BlockLibrary) {
     m_chunkShader.resolution = glGetUniformLocation(m_chunkShader.programId, "resolution");
     m_chunkShader.sunPosition = glGetUniformLocation(m_chunkShader.programId, "sunPosition");
     m_chunkShader.brightness = glGetUniformLocation(m_chunkShader.programId, "brightness");
+    m_chunkShader.cameraChunk = glGetUniformLocation(m_chunkShader.programId, "cameraChunk");
+    m_chunkShader.faceLighting = glGetUniformLocation(m_chunkShader.programId, "faceLighting");
+
+    std::vector<GLuint> indices;
+    indices.reserve(6 * MAX_QUADS);
+    for (GLuint quad = 0; quad < MAX_QUADS; ++quad) {
+        for (GLuint corner : {0, 1, 2, 3, 2, 1}) indices.push_back(4 * quad + corner);
+    }
+
+    glGenBuffers(1, &m_chunkShader.indexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_chunkShader.indexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * indices.size(), &indices[0],
+                 GL_STATIC_DRAW);
+
+    // Draw commands can be read straight from a buffer where the context allows
+    m_drawIndirect = GLEW_VERSION_4_3 || GLEW_ARB_multi_draw_indirect;
+    glGenBuffers(1, &m_chunkShader.indirectBuffer);
 
     //// Setup the screen tinting shader program
     vertexShader = loadShader("tint-vertex.glsl", GL_VERTEX_SHADER);
@@ -110,6 +127,8 @@ Renderer::~Renderer() {
     glDeleteVertexArrays(1, &m_vertexArray);
 
     glDeleteProgram(m_chunkShader.programId);
+    glDeleteBuffers(1, &m_chunkShader.indexBuffer);
+    glDeleteBuffers(1, &m_chunkShader.indirectBuffer);
 
     glDeleteProgram(m_tintShader.programId);
     glDeleteBuffers(1, &m_tintShader.vbo);
@@ -126,7 +145,8 @@ void Renderer::render(const Camera &camera, const std::vector<const Mesh *> &mes
     // 0.0f, 0.0f)); sun = glm::vec3(rotation * glm::vec4(sun, 1.0));
 
     // All of the blocks have the same view and projection matrices
-    buildViewProjectionMatrix(camera);
+    glm::mat4 vpMatrix = viewProjectionMatrix(camera);
+    glUniformMatrix4fv(m_chunkShader.vpMatrix, 1, GL_FALSE, &vpMatrix[0][0]);
 
     // Adjust the brighness level depending on the height of the sun
     float brightness = 1.0;
@@ -141,6 +161,17 @@ void Renderer::render(const Camera &camera, const std::vector<const Mesh *> &mes
 
     glUniform3fv(m_chunkShader.sunPosition, 1, &sun[0]);
 
+    // Every face of a cube in the same direction has the same lighting
+    std::array<GLfloat, 6> faceLighting;
+    for (size_t face = 0; face < 6; ++face) {
+        glm::vec3 normal = glm::normalize(cubeMesh[face * 6].normal);
+
+        float diffuse = glm::clamp(std::abs(0.7 * glm::dot(normal, glm::normalize(sun))), 0.0, 1.0);
+        float ambient = 0.3;
+        faceLighting[face] = glm::clamp(diffuse + ambient, 0.0f, 1.0f);
+    }
+    glUniform1fv(m_chunkShader.faceLighting, 6, &faceLighting[0]);
+
     glActiveTexture(GL_TEXTURE0);
     glUniform1i(m_chunkShader.textureSampler, 0);
     glUniform2f(m_chunkShader.resolution, m_width, m_height);
@@ -148,49 +179,110 @@ void Renderer::render(const Camera &camera, const std::vector<const Mesh *> &mes
     glBindTexture(GL_TEXTURE_2D_ARRAY, m_blockLibrary->getTextureArray());
 
     glEnableVertexAttribArray(m_chunkShader.position);
-    glEnableVertexAttribArray(m_chunkShader.texCoord);
-    glEnableVertexAttribArray(m_chunkShader.lighting);
+    glEnableVertexAttribArray(m_chunkShader.texture);
 
-    // Pass 1 - opaque blocks, front to back
-    glCullFace(GL_BACK);
+    // Vertices only store their chunk modulo 128 (see Vertex)
+    glUniform2i(m_chunkShader.cameraChunk, int(floor(camera.eye.x / Chunk::SIZE)),
+                int(floor(camera.eye.z / Chunk::SIZE)));
+
+    // Every four vertices make a quad, which is drawn with six indices
+    auto indexCount = [](size_t vertices) { return GLuint(vertices / 4 * 6); };
+
+    // The opaque meshes can be drawn in any order, so there is one batch per
+    // vertex buffer, keeping them front to back within it. The transparent meshes
+    // have to be drawn back to front, so a new batch starts whenever the buffer
+    // changes.
+    m_drawCommands.clear();
+    std::vector<Batch> opaqueBatches, transparentBatches;
+
+    std::map<GLuint, std::vector<DrawCommand>> opaqueCommands;
     for (const Mesh *mesh : meshes) {
-        glBindBuffer(GL_ARRAY_BUFFER, mesh->vertexBuffer);
-        glVertexAttribPointer(m_chunkShader.position, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                              (void *)offsetof(Vertex, position));
-        glVertexAttribPointer(m_chunkShader.texCoord, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                              (void *)offsetof(Vertex, texCoord));
-        glVertexAttribPointer(m_chunkShader.lighting, 1, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                              (void *)offsetof(Vertex, lighting));
-
-        glDrawArrays(GL_TRIANGLES, 0, mesh->opaqueVertices);
+        if (!mesh->opaqueVertices) continue;
+
+        DrawCommand command = {indexCount(mesh->opaqueVertices), 1, 0,
+                               GLint(mesh->vertices.first), 0};
+        opaqueCommands[mesh->vertices.buffer].push_back(command);
+    }
+
+    for (const auto &entry : opaqueCommands) {
+        opaqueBatches.push_back({entry.first, m_drawCommands.size(), entry.second.size()});
+        m_drawCommands.insert(m_drawCommands.end(), entry.second.begin(), entry.second.end());
     }
 
-    // Pass 2 - transparent blocks, back to front
-    if (underwater) glCullFace(GL_FRONT);
     for (auto i = meshes.rbegin(); i != meshes.rend(); ++i) {
         const Mesh *mesh = *i;
+        if (!mesh->transparentVertices) continue;
 
-        glBindBuffer(GL_ARRAY_BUFFER, mesh->vertexBuffer);
-        glVertexAttribPointer(m_chunkShader.position, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                              (void *)offsetof(Vertex, position));
-        glVertexAttribPointer(m_chunkShader.texCoord, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                              (void *)offsetof(Vertex, texCoord));
-        glVertexAttribPointer(m_chunkShader.lighting, 1, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                              (void *)offsetof(Vertex, lighting));
+        GLuint buffer = mesh->vertices.buffer;
+        if (transparentBatches.empty() || transparentBatches.back().buffer != buffer) {
+            transparentBatches.push_back({buffer, m_drawCommands.size(), 0});
+        }
+
+        DrawCommand command = {indexCount(mesh->transparentVertices), 1,
+                               indexCount(mesh->opaqueVertices), GLint(mesh->vertices.first), 0};
+        m_drawCommands.push_back(command);
+        ++transparentBatches.back().count;
+    }
 
-        glDrawArrays(GL_TRIANGLES, mesh->opaqueVertices, mesh->transparentVertices);
+    if (m_drawIndirect) {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_chunkShader.indirectBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawCommand) * m_drawCommands.size(),
+                     m_drawCommands.data(), GL_STREAM_DRAW);
     }
 
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_chunkShader.indexBuffer);
+
+    // Pass 1 - opaque blocks
+    glCullFace(GL_BACK);
+    drawBatches(opaqueBatches);
+
+    // Pass 2 - transparent blocks, back to front
+    if (underwater) glCullFace(GL_FRONT);
+    drawBatches(transparentBatches);
+
     // Good OpenGL hygiene
     glDisableVertexAttribArray(m_chunkShader.position);
-    glDisableVertexAttribArray(m_chunkShader.texCoord);
-    glDisableVertexAttribArray(m_chunkShader.lighting);
+    glDisableVertexAttribArray(m_chunkShader.texture);
 
     if (underwater) tintScreen(glm::vec3(0.0f, 0.0f, 1.0f));
 
     drawBlock(selected);
 }
 
+void Renderer::drawBatches(const std::vector<Batch> &batches) {
+    std::vector<GLsizei> counts;
+    std::vector<const void *> offsets;
+    std::vector<GLint> baseVertices;
+
+    for (const Batch &batch : batches) {
+        glBindBuffer(GL_ARRAY_BUFFER, batch.buffer);
+        glVertexAttribIPointer(m_chunkShader.position, 1, GL_UNSIGNED_INT, sizeof(Vertex),
+                               (void *)offsetof(Vertex, position));
+        glVertexAttribIPointer(m_chunkShader.texture, 1, GL_UNSIGNED_INT, sizeof(Vertex),
+                               (void *)offsetof(Vertex, texture));
+
+        if (m_drawIndirect) {
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                                        (void *)(batch.first * sizeof(DrawCommand)), batch.count,
+                                        0);
+            continue;
+        }
+
+        counts.clear();
+        offsets.clear();
+        baseVertices.clear();
+        for (size_t i = batch.first; i < batch.first + batch.count; ++i) {
+            const DrawCommand &command = m_drawCommands[i];
+            counts.push_back(command.count);
+            offsets.push_back((void *)(command.firstIndex * sizeof(GLuint)));
+            baseVertices.push_back(command.baseVertex);
+        }
+
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), GL_UNSIGNED_INT, offsets.data(),
+                                      batch.count, baseVertices.data());
+    }
+}
+
 void Renderer::tintScreen(const glm::vec3 &color) {
     glUseProgram(m_tintShader.programId);
     glDisable(GL_DEPTH_TEST);
@@ -245,7 +337,7 @@ void Renderer::setSize(int width, int height) {
     );
 }
 
-void Renderer::buildViewProjectionMatrix(const Camera &camera) const {
+glm::mat4 Renderer::viewProjectionMatrix(const Camera &camera) const {
     glm::mat4 rotation = glm::rotate(glm::mat4(1.0), glm::radians(camera.horizontalAngle),
                                      glm::vec3(0.0f, 1.0f, 0.0f));
     rotation =
@@ -255,6 +347,5 @@ void Renderer::buildViewProjectionMatrix(const Camera &camera) const {
 
     glm::mat4 view = glm::lookAt(camera.eye, camera.eye + gaze, up);
 
-    glm::mat4 mvp = m_projection * view;
-    glUniformMatrix4fv(m_chunkShader.vpMatrix, 1, GL_FALSE, &mvp[0][0]);
+    return m_projection * view;
 }